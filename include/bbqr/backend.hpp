@@ -0,0 +1,49 @@
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bbqr/error.hpp"
+
+namespace bbqr {
+// Deflate/inflate engine behind Encoding::Z. Streams are raw deflate without
+// a zlib header, and matches must not reach back more than 1 KB (wbits=-10),
+// so that any backend can inflate what another one deflated. A backend may
+// keep state (streams, buffers) between calls and need not be thread-safe.
+class CompressionBackend {
+ public:
+  virtual ~CompressionBackend() = default;
+
+  virtual const char *name() const noexcept = 0;
+  // Largest compressed size of size bytes
+  virtual size_t compress_bound(size_t size) const noexcept = 0;
+  // Deflates source into out, which is resized to the compressed size.
+  virtual Expected<void> compress(std::string_view source, std::string &out) noexcept = 0;
+  // Inflates the whole stream in source into out, which is resized to the
+  // inflated size. Malformed or truncated input is Error::DecompressionFailed.
+  virtual Expected<void> decompress(std::span<const unsigned char> source, std::vector<unsigned char> &out) noexcept = 0;
+  // Drops the state kept between calls.
+  virtual void reset() noexcept = 0;
+};
+
+enum class BackendType {
+  Zlib,         // zlib at its default level, for both directions
+  Builtin,      // the in-tree optimal-parse deflate and single-shot inflate
+  BuiltinFast,  // the in-tree fast deflate and single-shot inflate
+};
+
+std::unique_ptr<CompressionBackend> make_compression_backend(BackendType type);
+
+// The backend chosen with BBQR_COMPRESSION_BACKEND at configure time. Split
+// and join use it unless SplitOption::compression_backend or the backend
+// argument of a join names another one. The zlib default also tries the
+// in-tree inflater first, and lets zlib handle whatever that rejects.
+BackendType default_backend_type() noexcept;
+}  // namespace bbqr
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bbqr/bbqr.hpp"
+
+namespace bbqr {
+// Runs the jobs of a batch. Implement it to put batches on a pool the
+// application already has: run() must call job(i) exactly once for every i
+// below count, from any threads, and only return once all calls did. Lower
+// i are the larger jobs, so they should be started first.
+class BatchExecutor {
+ public:
+  virtual ~BatchExecutor() = default;
+
+  virtual void run(size_t count, const std::function<void(size_t)> &job) = 0;
+};
+
+// Work-stealing pool of threads threads (0 for one per core), the caller of
+// run() being one of them. The jobs are dealt round-robin to per-thread
+// queues; a thread takes its own from the front and, once out of them,
+// steals from the back of the others. One batch runs at a time: run() from
+// another thread waits for the current one, and a job must not call run().
+class ThreadPool final : public BatchExecutor {
+ public:
+  explicit ThreadPool(unsigned threads = 0);
+  ~ThreadPool() override;
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void run(size_t count, const std::function<void(size_t)> &job) override;
+  // Threads running jobs, including the caller of run()
+  size_t size() const noexcept;
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+struct Payload {
+  std::string_view raw;
+  FileType file_type;
+};
+
+// Splits every payload with option, on executor or else on a pool shared by
+// the process, and returns the results in input order. Each payload is split
+// on one thread, so option.threads is ignored. A compression_backend in
+// option is called from several threads at once and must allow that (the
+// built-in ones do, zlib's does not).
+std::vector<Expected<SplitResult>> split_batch(std::span<const Payload> payloads, const SplitOption &option = SplitOption(),
+                                               BatchExecutor *executor = nullptr) noexcept;
+
+// Joins every set of parts like try_join_qrs(), on executor or else on a pool
+// shared by the process, and returns the results in input order.
+template <typename RawType = std::vector<unsigned char>>
+std::vector<Expected<JoinResult<RawType>>> join_batch(std::span<const std::vector<std::string>> batches,
+                                                      BatchExecutor *executor = nullptr) noexcept;
+}  // namespace bbqr
+
+#endif
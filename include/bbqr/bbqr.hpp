@@ -1,14 +1,24 @@
 #ifndef BBQR_HPP
 #define BBQR_HPP
 
+#include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 
+#include "bbqr/error.hpp"
+
 namespace bbqr {
+constexpr int HEADER_LEN = 8;  // "B$" + encoding + file type + 2 digit count + 2 digit index
+
 enum class FileType : char {
   P = 'P',  // PSBT file
   T = 'T',  // Ready to send Bitcoin wire transaction
@@ -25,13 +35,36 @@ enum class Encoding : char {
   Z = 'Z',       // Zlib compressed (wbits=-10, no header)
 };
 
+struct PartHeader {
+  Encoding encoding;
+  FileType file_type;
+  int count;  // Total number of parts
+  int index;  // Index of this part
+};
+
+// Parses the 8-char header at the start of a part, without allocating.
+Expected<PartHeader> parse_header(std::string_view part) noexcept;
+
+// Cheap pre-filter for scanner frames: sets is_bbqr[i] if frames[i] starts
+// with a valid "B$<encoding><file type>" prefix and is longer than a header.
+// Returns the number of matching frames. is_bbqr must be as long as frames.
+size_t filter_frames(std::span<const std::string_view> frames, std::span<bool> is_bbqr) noexcept;
+
+class CompressionBackend;  // bbqr/backend.hpp
+
 struct SplitOption {
-  Encoding encoding = Encoding::Z;  // The encoding type (default is Z)
-  bool force_encoding = false;      // Whether to force the specified encoding
-  int min_version = 5;              // Minimum QR code version for encoding (default is 5)
-  int max_version = 40;             // Maximum QR code version for encoding (default is 40)
-  int min_split = 1;                // Minimum split size for encoding (default is 1)
-  int max_split = 1295;             // Minimum split size for encoding (default is max base36 = 1295)
+  Encoding encoding = Encoding::Z;                    // The encoding type (default is Z)
+  bool force_encoding = false;                        // Whether to force the specified encoding
+  int min_version = 5;                                // Minimum QR code version for encoding (default is 5)
+  int max_version = 40;                               // Maximum QR code version for encoding (default is 40)
+  int min_split = 1;                                  // Minimum split size for encoding (default is 1)
+  int max_split = 1295;                               // Minimum split size for encoding (default is max base36 = 1295)
+  double max_compression_ratio = 1.0;                 // Z is only used if it shrinks the data below this ratio (default is 1.0)
+  int compression_tuning_ms = 0;                      // Time Z may spend on other deflate settings to save parts (default is 0 = off)
+  int optimal_deflate_iterations = 0;                 // Rounds of the built-in optimal-parse deflate tried for Z (default is 0 = off)
+  CompressionBackend *compression_backend = nullptr;  // Deflates Z instead of the default backend; tuning is then off (default is nullptr)
+  bool fast_deflate = false;                          // Deflates Z with the built-in fast encoder unless a backend is set (default is false)
+  unsigned threads = 1;                               // Threads writing the parts of large payloads, 0 for one per core (default is 1)
 };
 
 struct SplitResult {
@@ -40,13 +73,109 @@ struct SplitResult {
   Encoding encoding;               // The actual encoding used
 };
 
+Expected<SplitResult> try_split_qrs(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption()) noexcept;
+Expected<SplitResult> try_split_qrs(const std::vector<unsigned char> &raw, FileType file_type, const SplitOption &option = SplitOption()) noexcept;
+
+// Like SplitResult, but the parts and their views live back to back in one
+// arena, so a split needs a constant number of allocations regardless of the
+// part count. The views stay valid as long as the arena (also when moved).
+struct ArenaSplitResult {
+  int version;                              // The QR code version
+  std::span<const std::string_view> parts;  // QR code parts, pointing into arena
+  Encoding encoding;                        // The actual encoding used
+  std::unique_ptr<std::byte[]> arena;       // Owns the parts and their views
+};
+
+Expected<ArenaSplitResult> try_split_qrs_arena(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption()) noexcept;
+Expected<ArenaSplitResult> try_split_qrs_arena(const std::vector<unsigned char> &raw, FileType file_type, const SplitOption &option = SplitOption()) noexcept;
+
+// Parts of a split, encoded one at a time when they are requested. The plan
+// (version, part count) is worked out from the raw size up front; for H and
+// Base32 nothing else is done before the first part, and only O(part) memory
+// is used. Z still compresses the whole payload, but encodes parts lazily.
+// The raw data passed to split_lazy() must outlive the LazySplit.
+class LazySplit {
+ public:
+  // Input iterator over the parts. The string_view it yields points into the
+  // iterator and is invalidated when it is incremented.
+  class iterator {
+   public:
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    std::string_view operator*() const { return part_; }
+    iterator &operator++();
+    void operator++(int) { ++*this; }
+    bool operator==(std::default_sentinel_t) const { return index_ >= split_->size(); }
+
+   private:
+    friend class LazySplit;
+    iterator(const LazySplit *split, size_t index);
+
+    const LazySplit *split_ = nullptr;
+    size_t index_ = 0;
+    std::string part_;  // reused for every part
+  };
+
+  int version() const { return version_; }
+  Encoding encoding() const { return encoding_; }
+  size_t size() const { return count_; }  // number of parts
+
+  // Part i (header and payload). Each call encodes the part again.
+  std::string part(size_t i) const;
+
+  iterator begin() const { return iterator(this, 0); }
+  std::default_sentinel_t end() const { return {}; }
+
+ private:
+  friend Expected<LazySplit> try_split_lazy(std::string_view raw, FileType file_type, const SplitOption &option) noexcept;
+  void write_part(size_t i, std::string &out) const;
+
+  std::string_view raw_;    // data to split, not owned
+  std::string compressed_;  // deflated raw data, used instead of raw_ for Z
+  FileType file_type_ = FileType::B;
+  Encoding encoding_ = Encoding::H;
+  int version_ = 0;
+  size_t count_ = 0;
+  size_t per_each_ = 0;  // encoded chars in every part but the last
+};
+
+Expected<LazySplit> try_split_lazy(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption()) noexcept;
+
+// Layout of the parts a split would produce, worked out without encoding
+struct SplitLayout {
+  int version;        // The QR code version
+  int count;          // Number of parts
+  int per_each;       // Payload chars in every part but the last
+  Encoding encoding;  // The encoding the parts would use
+};
+
+// The version and part count split_qrs() picks for encoded_size payload chars
+// in encoding, under option's version and split limits. No allocation and a
+// handful of probes of the capacity table, so it can be called for every
+// slider position.
+Expected<SplitLayout> try_plan_split(size_t encoded_size, Encoding encoding, const SplitOption &option = SplitOption()) noexcept;
+// try_plan_split() for raw, encoded as split_qrs() would. Exact for H and
+// Base32; for Z the deflated size is estimated from samples of raw (also to
+// decide whether Z pays off), so the layout may be off by a part or version.
+Expected<SplitLayout> try_plan_for_raw(std::string_view raw, const SplitOption &option = SplitOption()) noexcept;
+
+#if BBQR_EXCEPTIONS
 SplitResult split_qrs(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption());
 SplitResult split_qrs(const std::vector<unsigned char> &raw, FileType file_type, const SplitOption &option = SplitOption());
+ArenaSplitResult split_qrs_arena(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption());
+ArenaSplitResult split_qrs_arena(const std::vector<unsigned char> &raw, FileType file_type, const SplitOption &option = SplitOption());
+LazySplit split_lazy(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption());
+SplitLayout plan_split(size_t encoded_size, Encoding encoding, const SplitOption &option = SplitOption());
+SplitLayout plan_for_raw(std::string_view raw, const SplitOption &option = SplitOption());
+#endif
 
 template <typename RawType>
 struct JoinResult {
   static_assert(std::is_same<RawType, std::vector<unsigned char>>{} ||
-                std::is_same<RawType, std::string>{});
+                std::is_same<RawType, std::string>{} ||
+                std::is_same<RawType, std::span<std::byte>>{});  // join_into()
 
   FileType file_type;
   Encoding encoding;
@@ -57,8 +186,166 @@ struct JoinResult {
   bool is_complete;
 };
 
+// With a backend, Z is inflated by it instead of the default backend. With
+// threads other than 1 (0 for one per core), large H and Base32 payloads are
+// decoded on that many threads, each taking a run of parts; Z is always
+// inflated in order.
+template <typename RawType = std::vector<unsigned char>>
+Expected<JoinResult<RawType>> try_join_qrs(const std::vector<std::string> &parts, CompressionBackend *backend = nullptr, unsigned threads = 1) noexcept;
+
+// Size of the buffer join_into() needs for these parts. For H and Base32 this
+// also works for an incomplete set, once any part but the last was seen. Z
+// needs all parts, which are inflated (without keeping the output) to measure.
+Expected<size_t> decoded_size_upper_bound(const std::vector<std::string> &parts) noexcept;
+
+// Like join_qrs, but decodes straight into out. The returned raw is the
+// written prefix of out. threads is as for try_join_qrs().
+Expected<JoinResult<std::span<std::byte>>> try_join_into(const std::vector<std::string> &parts, std::span<std::byte> out, unsigned threads = 1) noexcept;
+
+#if BBQR_EXCEPTIONS
 template <typename RawType = std::vector<unsigned char>>
-JoinResult<RawType> join_qrs(const std::vector<std::string> &parts);
+JoinResult<RawType> join_qrs(const std::vector<std::string> &parts, CompressionBackend *backend = nullptr, unsigned threads = 1);
+
+JoinResult<std::span<std::byte>> join_into(const std::vector<std::string> &parts, std::span<std::byte> out, unsigned threads = 1);
+#endif
+
+class Inflater;
+
+// Incremental joiner for scanners: feed every decoded frame to add_part() as it
+// arrives. Each call only looks at the new part; the payload is decoded once,
+// when the last missing part is received.
+class Joiner {
+ public:
+  Joiner();
+  ~Joiner();
+  Joiner(Joiner &&) noexcept;
+  Joiner &operator=(Joiner &&) noexcept;
+
+  // Returns true if the part was new, false if it was already received, or
+  // the Error for malformed or conflicting parts. The joiner is left as it was
+  // if the part itself is rejected.
+  Expected<bool> try_add_part(std::string_view part) noexcept;
+#if BBQR_EXCEPTIONS
+  bool add_part(std::string_view part);
+#endif
+
+  bool is_complete() const { return complete_; }
+  float progress() const;
+  size_t expected_part_count() const { return count_; }
+  size_t processed_parts_count() const { return received_count_; }
+  // Value-initialized until the first part has been received.
+  FileType file_type() const;
+  Encoding encoding() const;
+
+  // Decoded data of the leading run of received parts (parts 0..k). For Z
+  // this is inflated as soon as the parts arrive, so consumers can start on
+  // the data early. Invalidated by the next add_part() call.
+  std::span<const unsigned char> prefix() const;
+
+  template <typename RawType = std::vector<unsigned char>>
+  JoinResult<RawType> result() const &;
+  template <typename RawType = std::vector<unsigned char>>
+  JoinResult<RawType> result() &&;
+
+  void reset();
+
+ private:
+  Expected<void> store_part(size_t idx, std::string_view data);
+  Expected<void> store_last_part(std::string_view data);
+  Expected<void> check_duplicate(size_t idx, std::string_view data);
+  Expected<void> advance_prefix();
+  // Undoes adding part idx, which was rejected with error, and returns it
+  Error reject_part(size_t idx, Error error);
+  Expected<void> decode_to_scratch(std::string_view data);
+  std::vector<unsigned char> &decoded();
+  const std::vector<unsigned char> &decoded() const;
+  Expected<void> finish();
+
+  std::string header_;                  // first 6 chars shared by all parts
+  size_t count_ = 0;                    // total number of parts
+  size_t received_count_ = 0;           // number of distinct parts received
+  std::vector<bool> received_;          // received-index bitmap
+  size_t part_len_ = 0;                 // encoded length of every part but the last
+  size_t block_size_ = 0;               // decoded length of every part but the last
+  std::string pending_last_;            // last part, kept until block_size_ is known
+  std::vector<unsigned char> buffer_;   // decoded parts at their final offsets
+  std::vector<unsigned char> scratch_;  // reused for parts that can't be decoded in place
+  size_t prefix_parts_ = 0;             // number of leading parts received
+  std::unique_ptr<Inflater> inflater_;  // inflates Z data of the leading parts
+  std::vector<unsigned char> raw_;      // inflated data for Z
+  bool complete_ = false;
+};
+
+// Joins several interleaved BBQr sequences, e.g. a camera seeing multiple
+// animated codes at once. Parts are routed to one Joiner per 6-char header
+// prefix ("B$" + encoding + file type + count). At most max_sessions
+// transfers are tracked; a new one evicts the least recently used.
+class MultiJoiner {
+ public:
+  // Called once for each transfer, from the add_part() call that completes it,
+  // once the part is added. It must not call into the MultiJoiner (add_part,
+  // erase, clear...), which can destroy the Joiner it is given.
+  using CompletionCallback = std::function<void(const Joiner &)>;
+
+  explicit MultiJoiner(size_t max_sessions = 8, CompletionCallback on_complete = {});
+
+  // Same as Joiner::try_add_part, for the transfer the part belongs to. Not
+  // noexcept, since it lets exceptions from the callback through.
+  Expected<bool> try_add_part(std::string_view part);
+#if BBQR_EXCEPTIONS
+  bool add_part(std::string_view part);
+#endif
+
+  size_t session_count() const { return sessions_.size(); }
+  // Joiner for the transfer with the given 6-char header prefix, or nullptr.
+  const Joiner *find(std::string_view header) const;
+  void erase(std::string_view header);
+  void clear() { sessions_.clear(); }
+
+ private:
+  struct Session {
+    std::string header;
+    Joiner joiner;
+    uint64_t last_used;
+  };
+
+  size_t max_sessions_;
+  CompletionCallback on_complete_;
+  std::vector<Session> sessions_;
+  uint64_t clock_ = 0;
+};
+
+// Reusable split/join context for servers handling many payloads. It keeps
+// its deflate/inflate streams (reset instead of re-initialized between
+// payloads) and its scratch buffers, which stay at the size of the largest
+// payload seen. Results are the same as with the free functions. A Codec is
+// not thread-safe; keep one per thread.
+class Codec {
+ public:
+  Codec();
+  ~Codec();
+  Codec(Codec &&) noexcept;
+  Codec &operator=(Codec &&) noexcept;
+
+  Expected<SplitResult> try_split_qrs(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption()) noexcept;
+  template <typename RawType = std::vector<unsigned char>>
+  Expected<JoinResult<RawType>> try_join_qrs(const std::vector<std::string> &parts, CompressionBackend *backend = nullptr, unsigned threads = 1) noexcept;
+
+  // Same as try_encode_data() and try_decode_data() in bbqr/utils.hpp.
+  Expected<std::pair<std::string, Encoding>> try_encode_data(std::string_view raw, Encoding encoding, bool force_encoding = false) noexcept;
+  template <typename RawType = std::vector<unsigned char>>
+  Expected<RawType> try_decode_data(const std::vector<std::string_view> &parts, Encoding encoding) noexcept;
+
+#if BBQR_EXCEPTIONS
+  SplitResult split_qrs(std::string_view raw, FileType file_type, const SplitOption &option = SplitOption());
+  template <typename RawType = std::vector<unsigned char>>
+  JoinResult<RawType> join_qrs(const std::vector<std::string> &parts, CompressionBackend *backend = nullptr, unsigned threads = 1);
+#endif
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
 }  // namespace bbqr
 
 #endif
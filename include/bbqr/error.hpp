@@ -0,0 +1,132 @@
+#ifndef BBQR_ERROR_HPP
+#define BBQR_ERROR_HPP
+
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+// The throwing API is only available when exceptions are enabled. Define
+// BBQR_NO_EXCEPTIONS (done by the BBQR_NO_EXCEPTIONS CMake option) to build
+// with -fno-exceptions and use the try_* functions only.
+#if !defined(BBQR_NO_EXCEPTIONS) && (defined(__cpp_exceptions) || defined(_CPPUNWIND))
+#define BBQR_EXCEPTIONS 1
+#else
+#define BBQR_EXCEPTIONS 0
+#endif
+
+namespace bbqr {
+enum class Error {
+  InvalidHeader = 1,       // Part too short, no B$ fixed header or bad base36
+  ConflictingHeader,       // Parts disagree on filetype, encoding or count
+  PartOutOfRange,          // Part index is not below the part count
+  DuplicateMismatch,       // Same part index received with different content
+  InconsistentPartLength,  // Parts (except the last) differ in length
+  InvalidEncoding,         // Unknown encoding
+  InvalidHex,              // Malformed hex data
+  InvalidBase32,           // Malformed base32 data
+  CompressionFailed,       // Deflate reported an error
+  DecompressionFailed,     // Inflate reported an error or data is truncated
+  VersionOutOfRange,       // Invalid min/max QR version in SplitOption
+  SplitOutOfRange,         // Invalid min/max split in SplitOption
+  CannotFit,               // Data does not fit the requested versions/splits
+  InvalidFileType,         // Unknown file type
+  BufferTooSmall,          // Caller-provided output buffer is too small
+  MissingParts,            // Not all parts are available yet
+};
+
+const char *error_message(Error error) noexcept;
+
+#if BBQR_EXCEPTIONS
+// Throws the exception the throwing API uses for error: std::out_of_range for
+// option errors, std::runtime_error for (de)compression failures and
+// std::invalid_argument otherwise.
+[[noreturn]] void throw_error(Error error);
+#endif
+
+// Minimal stand-in for C++23 std::expected<T, Error>, so the library itself
+// can stay on C++20. Holds either a value or the Error that prevented it.
+template <typename T>
+class [[nodiscard]] Expected {
+ public:
+  using value_type = T;
+  using error_type = Error;
+
+  Expected(const T &value) : storage_(value) {}
+  Expected(T &&value) : storage_(std::move(value)) {}
+  Expected(Error error) : storage_(error) {}
+
+  bool has_value() const noexcept { return storage_.index() == 0; }
+  explicit operator bool() const noexcept { return has_value(); }
+
+  T &operator*() & noexcept { return *std::get_if<0>(&storage_); }
+  const T &operator*() const & noexcept { return *std::get_if<0>(&storage_); }
+  T &&operator*() && noexcept { return std::move(*std::get_if<0>(&storage_)); }
+  T *operator->() noexcept { return std::get_if<0>(&storage_); }
+  const T *operator->() const noexcept { return std::get_if<0>(&storage_); }
+
+  // Accessing the value of an error throws it (or aborts without exceptions).
+  T &value() & {
+    check();
+    return **this;
+  }
+  const T &value() const & {
+    check();
+    return **this;
+  }
+  T &&value() && {
+    check();
+    return std::move(**this);
+  }
+
+  Error error() const noexcept { return *std::get_if<1>(&storage_); }
+
+  template <typename U>
+  T value_or(U &&default_value) const & {
+    return has_value() ? **this : static_cast<T>(std::forward<U>(default_value));
+  }
+
+ private:
+  void check() const {
+    if (!has_value()) {
+#if BBQR_EXCEPTIONS
+      throw_error(error());
+#else
+      std::abort();
+#endif
+    }
+  }
+
+  std::variant<T, Error> storage_;
+};
+
+template <>
+class [[nodiscard]] Expected<void> {
+ public:
+  using value_type = void;
+  using error_type = Error;
+
+  Expected() = default;
+  Expected(Error error) : error_(error) {}
+
+  bool has_value() const noexcept { return error_ == Error{}; }
+  explicit operator bool() const noexcept { return has_value(); }
+
+  void value() const {
+    if (!has_value()) {
+#if BBQR_EXCEPTIONS
+      throw_error(error_);
+#else
+      std::abort();
+#endif
+    }
+  }
+
+  Error error() const noexcept { return error_; }
+
+ private:
+  Error error_{};
+};
+}  // namespace bbqr
+
+#endif
@@ -1,12 +1,33 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include <cstddef>
 #include <initializer_list>
+#include <span>
 #include <string>
 
 #include "bbqr/bbqr.hpp"
 
 namespace bbqr {
+Expected<std::pair<std::string, Encoding>> try_encode_data(std::string_view raw, Encoding encoding, bool force_encoding = false) noexcept;
+Expected<std::pair<std::string, Encoding>> try_encode_data(const std::vector<unsigned char> &raw, Encoding encoding, bool force_encoding = false) noexcept;
+
+template <typename RawType = std::vector<unsigned char>>
+Expected<RawType> try_decode_data(const std::vector<std::string_view> &parts, Encoding encoding) noexcept;
+template <typename RawType = std::vector<unsigned char>>
+Expected<RawType> try_decode_data(const std::vector<std::string> &parts, Encoding encoding) noexcept;
+template <typename RawType = std::vector<unsigned char>>
+Expected<RawType> try_decode_data(const std::initializer_list<std::string> &parts, Encoding encoding) noexcept;
+
+// Size of the buffer try_decode_into() needs for these payloads. Exact for H
+// and Base32 (unless the hex contains whitespace). For Z the data is inflated
+// to measure it, without keeping the output.
+Expected<size_t> decoded_size_upper_bound(const std::vector<std::string_view> &parts, Encoding encoding) noexcept;
+// Decodes straight into out and returns the number of bytes written, or
+// Error::BufferTooSmall.
+Expected<size_t> try_decode_into(const std::vector<std::string_view> &parts, Encoding encoding, std::span<std::byte> out) noexcept;
+
+#if BBQR_EXCEPTIONS
 std::pair<std::string, Encoding> encode_data(std::string_view raw, Encoding encoding, bool force_encoding = false);
 std::pair<std::string, Encoding> encode_data(const std::vector<unsigned char> &raw, Encoding encoding, bool force_encoding = false);
 
@@ -16,8 +37,10 @@ template <typename RawType = std::vector<unsigned char>>
 RawType decode_data(const std::vector<std::string> &parts, Encoding encoding);
 template <typename RawType = std::vector<unsigned char>>
 RawType decode_data(const std::initializer_list<std::string> &parts, Encoding encoding);
+size_t decode_into(const std::vector<std::string_view> &parts, Encoding encoding, std::span<std::byte> out);
 
 std::string int2base36(int num);
+#endif
 }  // namespace bbqr
 
 #endif
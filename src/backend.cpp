@@ -0,0 +1,108 @@
+#include "bbqr/backend.hpp"
+
+#include <optional>
+
+#include "compression.hpp"
+
+namespace bbqr {
+namespace {
+class ZlibBackend final : public CompressionBackend {
+ public:
+  ZlibBackend() { reset(); }
+
+  const char *name() const noexcept override { return "zlib"; }
+  // compressBound() only holds for the default 32 KB window; this is the
+  // bound deflateBound() falls back to for any other window, less the header.
+  size_t compress_bound(size_t size) const noexcept override {
+    return size + ((size + 7) >> 3) + ((size + 63) >> 6) + 5;
+  }
+
+  Expected<void> compress(std::string_view source, std::string &out) noexcept override {
+    return compressor_->compress(source, out);
+  }
+
+  Expected<void> decompress(std::span<const unsigned char> source, std::vector<unsigned char> &out) noexcept override {
+    return decompressor_->uncompress(source, out);
+  }
+
+  void reset() noexcept override {
+    compressor_.emplace();
+    decompressor_.emplace(false);  // zlib alone, so it can be compared with the others
+  }
+
+ private:
+  std::optional<ZlibCompressor> compressor_;
+  std::optional<ZlibDecompressor> decompressor_;
+};
+
+// Stateless, so one instance can serve every thread
+class BuiltinBackend final : public CompressionBackend {
+ public:
+  // One round of the optimal parse already matches or beats zlib -9 on
+  // BBQr's test payloads; further rounds add little for the time they take.
+  static constexpr int DEFLATE_ITERATIONS = 1;
+
+  explicit BuiltinBackend(bool fast) : fast_(fast) {}
+
+  const char *name() const noexcept override { return fast_ ? "builtin-fast" : "builtin"; }
+  size_t compress_bound(size_t size) const noexcept override { return deflate_optimal_bound(size); }
+
+  Expected<void> compress(std::string_view source, std::string &out) noexcept override {
+    if (fast_) {
+      deflate_fast(source, out);
+    } else {
+      deflate_optimal(source, out, DEFLATE_ITERATIONS);
+    }
+    return {};
+  }
+
+  Expected<void> decompress(std::span<const unsigned char> source, std::vector<unsigned char> &out) noexcept override {
+    if (!fast_inflate(source, out)) {
+      return Error::DecompressionFailed;
+    }
+    return {};
+  }
+
+  void reset() noexcept override {}
+
+ private:
+  bool fast_;
+};
+}  // namespace
+
+std::unique_ptr<CompressionBackend> make_compression_backend(BackendType type) {
+  switch (type) {
+    case BackendType::Zlib:
+      return std::make_unique<ZlibBackend>();
+    case BackendType::Builtin:
+      return std::make_unique<BuiltinBackend>(false);
+    case BackendType::BuiltinFast:
+      return std::make_unique<BuiltinBackend>(true);
+  }
+  return nullptr;
+}
+
+BackendType default_backend_type() noexcept {
+#if BBQR_BUILTIN_BACKEND
+  return BackendType::Builtin;
+#else
+  return BackendType::Zlib;
+#endif
+}
+
+CompressionBackend *resolve_backend(CompressionBackend *backend, bool fast) noexcept {
+  static BuiltinBackend fast_backend(true);
+  if (backend) {
+    return backend;
+  }
+  if (fast) {
+    return &fast_backend;
+  }
+#if BBQR_BUILTIN_BACKEND
+  static BuiltinBackend builtin(false);
+  return &builtin;
+#else
+  return nullptr;
+#endif
+}
+}  // namespace bbqr
@@ -0,0 +1,345 @@
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#include "simd.hpp"
+#include "strencoding.hpp"
+
+// Every 5 bytes are one 40-bit block that encodes to 8 chars. To encode, a
+// block is loaded big endian into a 64-bit lane and its 5-bit groups are
+// spread into the 8 bytes of the lane (first group in the lowest byte) by
+// halving the field width three times: 20 bits per 32, 10 per 16, 5 per 8.
+// Decoding validates and maps 8 chars to their 5-bit values and packs them
+// back the same way (5 per 8 to 10 per 16 to 20 per 32 to 40 per 64). The
+// SIMD paths run the same steps on 2, 4 or 8 lanes at once.
+
+namespace bbqr {
+namespace {
+constexpr uint64_t MASK_20 = 0x000FFFFFull;
+constexpr uint64_t MASK_10 = 0x000003FF000003FFull;
+constexpr uint64_t MASK_5 = 0x001F001F001F001Full;
+
+// Map 0..25 to 'A'..'Z' and 26..31 to '2'..'7'
+constexpr char BASE32_LOW = 'A';
+constexpr char BASE32_HIGH_ADJUST = 'A' - ('2' - 26);
+
+inline uint64_t SpreadBlock(uint64_t x) {
+  x = (x >> 20) | ((x & MASK_20) << 32);
+  x = ((x >> 10) & MASK_10) | ((x & MASK_10) << 16);
+  return ((x >> 5) & MASK_5) | ((x & MASK_5) << 8);
+}
+
+inline uint64_t ToBase32Chars(uint64_t v) {
+  constexpr uint64_t ONES = 0x0101010101010101ull;
+  // bit 7 of each byte of v + 102 is set iff that byte is >= 26
+  uint64_t high = ((v + ONES * (128 - 26)) >> 7) & ONES;
+  return v + ONES * BASE32_LOW - high * BASE32_HIGH_ADJUST;
+}
+
+size_t EncodeBlocksSwar(const unsigned char *in, size_t size, char *out) {
+  size_t n = size / 5 * 5;
+  for (size_t i = 0; i < n; i += 5, out += 8) {
+    uint64_t x = (uint64_t(in[i]) << 32) | (uint64_t(in[i + 1]) << 24) | (uint64_t(in[i + 2]) << 16) |
+                 (uint64_t(in[i + 3]) << 8) | uint64_t(in[i + 4]);
+    uint64_t chars = ToBase32Chars(SpreadBlock(x));
+    if constexpr (std::endian::native == std::endian::little) {
+      std::memcpy(out, &chars, 8);
+    } else {
+      for (int j = 0; j < 8; ++j) {
+        out[j] = static_cast<char>(chars >> (8 * j));
+      }
+    }
+  }
+  return n;
+}
+
+// Values of 8 chars. Bit 7 of each byte of valid is set iff that char is a
+// base32 char (either case).
+inline uint64_t FromBase32Chars(uint64_t c, uint64_t &valid) {
+  constexpr uint64_t ONES = 0x0101010101010101ull;
+  constexpr uint64_t HIGH = ONES * 0x80;
+  // bit 7 of each byte is set iff that (7-bit) char is >= k
+  uint64_t c7 = c & ~HIGH;
+  const auto at_least = [&](char k) { return (c7 + ONES * (0x80 - k)) & HIGH; };
+  uint64_t upper = at_least('A') & ~at_least('Z' + 1);
+  uint64_t lower = at_least('a') & ~at_least('z' + 1);
+  uint64_t digit = at_least('2') & ~at_least('7' + 1);
+  valid = (upper | lower | digit) & ~c;
+  return c7 - (upper >> 7) * 'A' - (lower >> 7) * 'a' - (digit >> 7) * ('2' - 26);
+}
+
+inline uint64_t PackBlock(uint64_t v) {
+  v = ((v & 0x00FF00FF00FF00FFull) << 5) | ((v >> 8) & 0x00FF00FF00FF00FFull);
+  v = ((v & 0x0000FFFF0000FFFFull) << 10) | ((v >> 16) & 0x0000FFFF0000FFFFull);
+  return ((v & 0xFFFFFFFFull) << 20) | (v >> 32);
+}
+
+std::optional<size_t> DecodeBlocksSwar(const char *in, size_t size, unsigned char *out) {
+  constexpr uint64_t HIGH = 0x8080808080808080ull;
+
+  size_t n = size / 8 * 8;
+  uint64_t invalid = 0;
+  for (size_t i = 0; i < n; i += 8, out += 5) {
+    uint64_t c = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+      std::memcpy(&c, in + i, 8);
+    } else {
+      for (int j = 0; j < 8; ++j) {
+        c |= uint64_t(uint8_t(in[i + j])) << (8 * j);
+      }
+    }
+    uint64_t valid;
+    uint64_t x = PackBlock(FromBase32Chars(c, valid));
+    invalid |= valid ^ HIGH;
+
+    unsigned char bytes[5];
+    for (int j = 0; j < 5; ++j) {
+      bytes[j] = static_cast<unsigned char>(x >> (32 - 8 * j));
+    }
+    std::memcpy(out, bytes, 5);
+  }
+  if (invalid) {
+    return std::nullopt;
+  }
+  return n;
+}
+
+#if BBQR_SIMD_X86
+// GCC 12 warns about _mm512_undefined_epi32() inside its own AVX-512
+// intrinsics, hence the pragmas around the AVX-512 functions.
+
+// Each 128-bit lane holds 10 input bytes (2 blocks); reverse each block into
+// the low 5 bytes of its 64-bit half.
+#define BBQR_BLOCK_SHUFFLE 4, 3, 2, 1, 0, -1, -1, -1, 9, 8, 7, 6, 5, -1, -1, -1
+
+__attribute__((target("ssse3"))) size_t EncodeBlocksSsse3(const unsigned char *in, size_t size, char *out) {
+  const __m128i shuffle = _mm_setr_epi8(BBQR_BLOCK_SHUFFLE);
+  const __m128i mask_20 = _mm_set1_epi64x(MASK_20);
+  const __m128i mask_10 = _mm_set1_epi64x(MASK_10);
+  const __m128i mask_5 = _mm_set1_epi64x(MASK_5);
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 10, out += 16) {
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), shuffle);
+    x = _mm_or_si128(_mm_srli_epi64(x, 20), _mm_slli_epi64(_mm_and_si128(x, mask_20), 32));
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi64(x, 10), mask_10), _mm_slli_epi64(_mm_and_si128(x, mask_10), 16));
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi64(x, 5), mask_5), _mm_slli_epi64(_mm_and_si128(x, mask_5), 8));
+    __m128i high = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(25)), _mm_set1_epi8(BASE32_HIGH_ADJUST));
+    x = _mm_sub_epi8(_mm_add_epi8(x, _mm_set1_epi8(BASE32_LOW)), high);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), x);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t EncodeBlocksAvx2(const unsigned char *in, size_t size, char *out) {
+  const __m256i shuffle = _mm256_setr_epi8(BBQR_BLOCK_SHUFFLE, BBQR_BLOCK_SHUFFLE);
+  const __m256i mask_20 = _mm256_set1_epi64x(MASK_20);
+  const __m256i mask_10 = _mm256_set1_epi64x(MASK_10);
+  const __m256i mask_5 = _mm256_set1_epi64x(MASK_5);
+
+  size_t i = 0;
+  for (; i + 26 <= size; i += 20, out += 32) {
+    __m256i x = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 10)), 1);
+    x = _mm256_shuffle_epi8(x, shuffle);
+    x = _mm256_or_si256(_mm256_srli_epi64(x, 20), _mm256_slli_epi64(_mm256_and_si256(x, mask_20), 32));
+    x = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(x, 10), mask_10), _mm256_slli_epi64(_mm256_and_si256(x, mask_10), 16));
+    x = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(x, 5), mask_5), _mm256_slli_epi64(_mm256_and_si256(x, mask_5), 8));
+    __m256i high = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(25)), _mm256_set1_epi8(BASE32_HIGH_ADJUST));
+    x = _mm256_sub_epi8(_mm256_add_epi8(x, _mm256_set1_epi8(BASE32_LOW)), high);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), x);
+  }
+  return i;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f,avx512bw"))) size_t EncodeBlocksAvx512(const unsigned char *in, size_t size, char *out) {
+  const __m512i shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(BBQR_BLOCK_SHUFFLE));
+  const __m512i mask_20 = _mm512_set1_epi64(MASK_20);
+  const __m512i mask_10 = _mm512_set1_epi64(MASK_10);
+  const __m512i mask_5 = _mm512_set1_epi64(MASK_5);
+
+  size_t i = 0;
+  for (; i + 46 <= size; i += 40, out += 64) {
+    const auto load = [&](size_t offset) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + offset)); };
+    __m512i x = _mm512_broadcast_i32x4(load(0));
+    x = _mm512_inserti32x4(x, load(10), 1);
+    x = _mm512_inserti32x4(x, load(20), 2);
+    x = _mm512_inserti32x4(x, load(30), 3);
+    x = _mm512_shuffle_epi8(x, shuffle);
+    x = _mm512_or_si512(_mm512_srli_epi64(x, 20), _mm512_slli_epi64(_mm512_and_si512(x, mask_20), 32));
+    x = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi64(x, 10), mask_10), _mm512_slli_epi64(_mm512_and_si512(x, mask_10), 16));
+    x = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi64(x, 5), mask_5), _mm512_slli_epi64(_mm512_and_si512(x, mask_5), 8));
+    __mmask64 high = _mm512_cmpgt_epi8_mask(x, _mm512_set1_epi8(25));
+    x = _mm512_add_epi8(x, _mm512_set1_epi8(BASE32_LOW));
+    x = _mm512_mask_sub_epi8(x, high, x, _mm512_set1_epi8(BASE32_HIGH_ADJUST));
+    _mm512_storeu_si512(out, x);
+  }
+  return i;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Each 128-bit lane holds 2 blocks packed into the low 40 bits of its 64-bit
+// halves; move their bytes big endian to the start of the lane.
+#define BBQR_PACK_SHUFFLE 4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1
+
+// The SIMD decoders store whole lanes, i.e. up to 6 bytes past the blocks
+// they decode. Their loops stop early enough for those bytes to belong to
+// blocks that are decoded afterwards, so out never overflows.
+
+__attribute__((target("ssse3"))) std::optional<size_t> DecodeBlocksSsse3(const char *in, size_t size, unsigned char *out) {
+  const __m128i pack = _mm_setr_epi8(BBQR_PACK_SHUFFLE);
+  const __m128i mask_32 = _mm_set1_epi64x(0xFFFFFFFF);
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 16, out += 10) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i upper = InRange(c, 'A', 'Z');
+    __m128i lower = InRange(c, 'a', 'z');
+    __m128i digit = InRange(c, '2', '7');
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), digit)) != 0xFFFF) {
+      return std::nullopt;
+    }
+    __m128i offset = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8('A')),
+                                               _mm_and_si128(lower, _mm_set1_epi8('a'))),
+                                  _mm_and_si128(digit, _mm_set1_epi8('2' - 26)));
+    __m128i x = _mm_sub_epi8(c, offset);
+    x = _mm_maddubs_epi16(x, _mm_set1_epi16(0x0120));   // 32 * first + second
+    x = _mm_madd_epi16(x, _mm_set1_epi32(0x00010400));  // 1024 * first + second
+    x = _mm_or_si128(_mm_slli_epi64(_mm_and_si128(x, mask_32), 20), _mm_srli_epi64(x, 32));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(x, pack));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) std::optional<size_t> DecodeBlocksAvx2(const char *in, size_t size, unsigned char *out) {
+  const __m256i pack = _mm256_setr_epi8(BBQR_PACK_SHUFFLE, BBQR_PACK_SHUFFLE);
+  const __m256i mask_32 = _mm256_set1_epi64x(0xFFFFFFFF);
+
+  size_t i = 0;
+  for (; i + 48 <= size; i += 32, out += 20) {
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    __m256i upper = InRange(c, 'A', 'Z');
+    __m256i lower = InRange(c, 'a', 'z');
+    __m256i digit = InRange(c, '2', '7');
+    if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(upper, lower), digit)) != -1) {
+      return std::nullopt;
+    }
+    __m256i offset = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8('A')),
+                                                     _mm256_and_si256(lower, _mm256_set1_epi8('a'))),
+                                     _mm256_and_si256(digit, _mm256_set1_epi8('2' - 26)));
+    __m256i x = _mm256_sub_epi8(c, offset);
+    x = _mm256_maddubs_epi16(x, _mm256_set1_epi16(0x0120));
+    x = _mm256_madd_epi16(x, _mm256_set1_epi32(0x00010400));
+    x = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(x, mask_32), 20), _mm256_srli_epi64(x, 32));
+    x = _mm256_shuffle_epi8(x, pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm256_castsi256_si128(x));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 10), _mm256_extracti128_si256(x, 1));
+  }
+  return i;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f,avx512bw"))) std::optional<size_t> DecodeBlocksAvx512(const char *in, size_t size, unsigned char *out) {
+  const __m512i pack = _mm512_broadcast_i32x4(_mm_setr_epi8(BBQR_PACK_SHUFFLE));
+  const __m512i mask_32 = _mm512_set1_epi64(0xFFFFFFFF);
+
+  size_t i = 0;
+  for (; i + 80 <= size; i += 64, out += 40) {
+    __m512i c = _mm512_loadu_si512(in + i);
+    __mmask64 upper = InRange(c, 'A', 'Z');
+    __mmask64 lower = InRange(c, 'a', 'z');
+    __mmask64 digit = InRange(c, '2', '7');
+    if ((upper | lower | digit) != ~__mmask64(0)) {
+      return std::nullopt;
+    }
+    __m512i x = _mm512_mask_sub_epi8(c, upper, c, _mm512_set1_epi8('A'));
+    x = _mm512_mask_sub_epi8(x, lower, x, _mm512_set1_epi8('a'));
+    x = _mm512_mask_sub_epi8(x, digit, x, _mm512_set1_epi8('2' - 26));
+    x = _mm512_maddubs_epi16(x, _mm512_set1_epi16(0x0120));
+    x = _mm512_madd_epi16(x, _mm512_set1_epi32(0x00010400));
+    x = _mm512_or_si512(_mm512_slli_epi64(_mm512_and_si512(x, mask_32), 20), _mm512_srli_epi64(x, 32));
+    x = _mm512_shuffle_epi8(x, pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm512_castsi512_si128(x));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 10), _mm512_extracti32x4_epi32(x, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 20), _mm512_extracti32x4_epi32(x, 2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 30), _mm512_extracti32x4_epi32(x, 3));
+  }
+  return i;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#undef BBQR_PACK_SHUFFLE
+#undef BBQR_BLOCK_SHUFFLE
+#endif
+
+using EncodeBlocksFn = size_t (*)(const unsigned char *, size_t, char *);
+
+EncodeBlocksFn SelectEncodeBlocks() {
+  switch (DetectSimdLevel()) {
+#if BBQR_SIMD_X86
+    case SimdLevel::Avx512:
+      return EncodeBlocksAvx512;
+    case SimdLevel::Avx2:
+      return EncodeBlocksAvx2;
+    case SimdLevel::Ssse3:
+      return EncodeBlocksSsse3;
+#endif
+    default:
+      return EncodeBlocksSwar;
+  }
+}
+
+using DecodeBlocksFn = std::optional<size_t> (*)(const char *, size_t, unsigned char *);
+
+DecodeBlocksFn SelectDecodeBlocks() {
+  switch (DetectSimdLevel()) {
+#if BBQR_SIMD_X86
+    case SimdLevel::Avx512:
+      return DecodeBlocksAvx512;
+    case SimdLevel::Avx2:
+      return DecodeBlocksAvx2;
+    case SimdLevel::Ssse3:
+      return DecodeBlocksSsse3;
+#endif
+    default:
+      return DecodeBlocksSwar;
+  }
+}
+}  // namespace
+
+size_t EncodeBase32Blocks(std::string_view input, char *out) noexcept {
+  static const EncodeBlocksFn encode_blocks = SelectEncodeBlocks();
+
+  const auto *in = reinterpret_cast<const unsigned char *>(input.data());
+  size_t done = encode_blocks(in, input.size(), out);
+  return done + EncodeBlocksSwar(in + done, input.size() - done, out + done / 5 * 8);
+}
+
+std::optional<size_t> DecodeBase32Blocks(std::string_view str, unsigned char *out) noexcept {
+  static const DecodeBlocksFn decode_blocks = SelectDecodeBlocks();
+
+  auto done = decode_blocks(str.data(), str.size(), out);
+  if (!done) {
+    return std::nullopt;
+  }
+  auto rest = DecodeBlocksSwar(str.data() + *done, str.size() - *done, out + *done / 8 * 5);
+  if (!rest) {
+    return std::nullopt;
+  }
+  return *done + *rest;
+}
+}  // namespace bbqr
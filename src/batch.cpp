@@ -0,0 +1,187 @@
+#include "bbqr/batch.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <system_error>
+#include <thread>
+
+namespace bbqr {
+struct ThreadPool::State {
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+  };
+
+  explicit State(size_t threads) : queues(threads) {}
+
+  std::vector<Queue> queues;  // one per thread, the caller of run() owning the first
+  std::vector<std::jthread> threads;
+
+  std::mutex batch_mutex;  // held by run() for a whole batch
+  std::mutex mutex;        // guards the fields below
+  std::condition_variable wake, done;
+  const std::function<void(size_t)> *job = nullptr;  // set while a batch runs
+  size_t generation = 0;                             // batches started so far
+  size_t active = 0;                                 // pool threads inside work()
+  bool stop = false;
+
+  bool pop(size_t self, size_t &index) {
+    Queue &own = queues[self];
+    std::lock_guard lock(own.mutex);
+    if (own.jobs.empty()) {
+      return false;
+    }
+    index = own.jobs.front();
+    own.jobs.pop_front();
+    return true;
+  }
+
+  bool steal(size_t self, size_t &index) {
+    for (size_t i = 1; i < queues.size(); ++i) {
+      Queue &other = queues[(self + i) % queues.size()];
+      std::lock_guard lock(other.mutex);
+      if (!other.jobs.empty()) {
+        index = other.jobs.back();
+        other.jobs.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Runs jobs until every queue is empty
+  void work(size_t self, const std::function<void(size_t)> &run) {
+    size_t index;
+    while (pop(self, index) || steal(self, index)) {
+      run(index);
+    }
+  }
+
+  void thread_main(size_t self) {
+    size_t seen = 0;
+    for (;;) {
+      const std::function<void(size_t)> *run;
+      {
+        std::unique_lock lock(mutex);
+        wake.wait(lock, [&] { return stop || (job && generation != seen); });
+        if (stop) {
+          return;
+        }
+        // while this thread is active, the batch cannot end and job stays valid
+        seen = generation;
+        run = job;
+        ++active;
+      }
+      work(self, *run);
+      {
+        std::lock_guard lock(mutex);
+        --active;
+      }
+      done.notify_one();
+    }
+  }
+};
+
+static unsigned thread_count(unsigned threads) {
+  return threads ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+ThreadPool::ThreadPool(unsigned threads) : state_(std::make_unique<State>(thread_count(threads))) {
+  threads = thread_count(threads);
+  state_->threads.reserve(threads - 1);
+  for (size_t self = 1; self < threads; ++self) {
+#if BBQR_EXCEPTIONS
+    try {
+      state_->threads.emplace_back(&State::thread_main, state_.get(), self);
+    } catch (const std::system_error &) {
+      break;  // the jobs dealt to the missing threads get stolen
+    }
+#else
+    state_->threads.emplace_back(&State::thread_main, state_.get(), self);
+#endif
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(state_->mutex);
+    state_->stop = true;
+  }
+  state_->wake.notify_all();
+  state_->threads.clear();  // joins them
+}
+
+size_t ThreadPool::size() const noexcept {
+  return state_->threads.size() + 1;
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)> &job) {
+  if (count == 0) {
+    return;
+  }
+
+  State &state = *state_;
+  std::lock_guard batch(state.batch_mutex);
+  {
+    std::lock_guard lock(state.mutex);
+    for (size_t i = 0; i < count; ++i) {
+      state.queues[i % state.queues.size()].jobs.push_back(i);
+    }
+    state.job = &job;
+    ++state.generation;
+  }
+  state.wake.notify_all();
+
+  state.work(0, job);
+  std::unique_lock lock(state.mutex);
+  state.done.wait(lock, [&] { return state.active == 0; });
+  state.job = nullptr;
+}
+
+static ThreadPool &shared_pool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+// Runs job(i) for every index of sizes on executor (or the shared pool),
+// largest first
+static void run_by_size(const std::vector<size_t> &sizes, BatchExecutor *executor, const std::function<void(size_t)> &job) {
+  std::vector<size_t> order(sizes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::ranges::stable_sort(order, std::greater(), [&](size_t i) { return sizes[i]; });
+  (executor ? *executor : shared_pool()).run(order.size(), [&](size_t i) { job(order[i]); });
+}
+
+std::vector<Expected<SplitResult>> split_batch(std::span<const Payload> payloads, const SplitOption &option,
+                                               BatchExecutor *executor) noexcept {
+  SplitOption single = option;
+  single.threads = 1;
+
+  std::vector<size_t> sizes(payloads.size());
+  std::ranges::transform(payloads, sizes.begin(), [](const Payload &payload) { return payload.raw.size(); });
+  // every slot is overwritten by its job
+  std::vector<Expected<SplitResult>> results(payloads.size(), Error::MissingParts);
+  run_by_size(sizes, executor, [&](size_t i) { results[i] = try_split_qrs(payloads[i].raw, payloads[i].file_type, single); });
+  return results;
+}
+
+template <typename RawType>
+std::vector<Expected<JoinResult<RawType>>> join_batch(std::span<const std::vector<std::string>> batches,
+                                                      BatchExecutor *executor) noexcept {
+  std::vector<size_t> sizes(batches.size());
+  std::ranges::transform(batches, sizes.begin(), [](const std::vector<std::string> &parts) {
+    return std::transform_reduce(parts.begin(), parts.end(), size_t(0), std::plus(), [](const std::string &part) { return part.size(); });
+  });
+  std::vector<Expected<JoinResult<RawType>>> results(batches.size(), Error::MissingParts);
+  run_by_size(sizes, executor, [&](size_t i) { results[i] = try_join_qrs<RawType>(batches[i]); });
+  return results;
+}
+
+template std::vector<Expected<JoinResult<std::vector<unsigned char>>>> join_batch(std::span<const std::vector<std::string>> batches,
+                                                                                   BatchExecutor *executor) noexcept;
+template std::vector<Expected<JoinResult<std::string>>> join_batch(std::span<const std::vector<std::string>> batches,
+                                                                    BatchExecutor *executor) noexcept;
+}  // namespace bbqr
@@ -1,13 +1,17 @@
 #include "bbqr/bbqr.hpp"
 
 #include <algorithm>
-#include <sstream>
-#include <stdexcept>
+#include <array>
+#include <chrono>
+#include <climits>
+#include <memory>
 #include <string>
 
 #include "bbqr/utils.hpp"
-
-constexpr int HEADER_LEN = 8;
+#include "compression.hpp"
+#include "decoding.hpp"
+#include "parallel.hpp"
+#include "strencoding.hpp"
 
 namespace bbqr {
 
@@ -38,28 +42,45 @@ num_qr_needed(int version, int size, int split_mod) {
   return {count, adjustedCap};
 }
 
-static std::tuple<int /* count */, int /* version */, int /* per each */>
-find_best_version(int size, int split_mod, int min_split, int max_split,
-                  int min_version, int max_version) {
-  std::vector<std::tuple<int, int, int>> options;
-  for (int version = min_version; version <= max_version; ++version) {
-    auto [count, per_each] = num_qr_needed(version, size, split_mod);
-    if (min_split <= count && count <= max_split) {
-      options.emplace_back(count, version, per_each);
+// Smallest version in [low, high] for which pred holds, or high + 1. pred must
+// hold for every version above one it holds for.
+template <typename Pred>
+static int first_version(int low, int high, Pred&& pred) {
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    if (pred(mid)) {
+      high = mid - 1;
+    } else {
+      low = mid + 1;
     }
   }
-  if (options.empty()) {
-    throw std::invalid_argument("Cannot make it fit");
+  return low;
+}
+
+// Fewest parts, then lowest version. A larger version never needs more parts,
+// so the versions with an allowed part count are one run, the last of which
+// needs the fewest, and three bisections of at most 40 versions find the
+// answer without trying every version.
+static Expected<std::tuple<int /* count */, int /* version */, int /* per each */>>
+find_best_version(int size, int split_mod, int min_split, int max_split,
+                  int min_version, int max_version) {
+  const auto count = [&](int version) { return num_qr_needed(version, size, split_mod).first; };
+  int low = first_version(min_version, max_version, [&](int version) { return count(version) <= max_split; });
+  int high = first_version(min_version, max_version, [&](int version) { return count(version) < min_split; }) - 1;
+  if (low > high) {
+    return Error::CannotFit;
   }
-  std::sort(options.begin(), options.end());
-  return options.front();
+  int fewest = count(high);
+  int best = first_version(low, high, [&](int version) { return count(version) <= fewest; });
+  auto [parts, per_each] = num_qr_needed(best, size, split_mod);
+  return std::tuple(parts, best, per_each);
 }
 
 static int get_split_mod(Encoding encoding) {
   return encoding == Encoding::H ? 2 : 8;
 }
 
-static void validateSplitOption(const SplitOption& option) {
+static Expected<void> validateSplitOption(const SplitOption& option) {
   constexpr auto is_valid_version = [](int version) {
     return version >= 1 && version <= 40;
   };
@@ -71,120 +92,995 @@ static void validateSplitOption(const SplitOption& option) {
   if (option.min_version > option.max_version ||
       !is_valid_version(option.min_version) ||
       !is_valid_version(option.max_version)) {
-    throw std::out_of_range("min/max version out of range");
+    return Error::VersionOutOfRange;
   }
 
   if (option.min_split > option.max_split ||
       !is_valid_split(option.min_split) ||
       !is_valid_split(option.max_split)) {
-    throw std::out_of_range("min/max split out of range");
+    return Error::SplitOutOfRange;
   }
+  return {};
 }
 
-SplitResult split_qrs(std::string_view raw, FileType file_type, const SplitOption& option) {
-  validateSplitOption(option);
+static std::array<char, 2> base36_digits(int num) {
+  constexpr auto tostr = [](int x) -> char {
+    return (x < 10) ? '0' + x : 'A' + x - 10;
+  };
+  return {tostr(num / 36), tostr(num % 36)};
+}
+
+static size_t encoded_size(Encoding encoding, size_t size) {
+  return encoding == Encoding::H ? 2 * size : EncodedBase32Size(size);
+}
+
+// The bytes of source that part i of count encodes. per_each is a multiple of
+// the split mod, so every part but the last encodes a whole number of bytes on
+// its own.
+static std::string_view part_source(std::string_view source, Encoding encoding, size_t count, int per_each, size_t i) {
+  if (count == 1) {
+    return source;
+  }
+  size_t bytes_per = encoding == Encoding::H ? per_each / 2 : per_each / 8 * 5;
+  return source.substr(std::min(i * bytes_per, source.size()), bytes_per);
+}
+
+static char* write_header(char* out, Encoding encoding, FileType file_type, int count, int index) {
+  *out++ = 'B';
+  *out++ = '$';
+  *out++ = static_cast<char>(encoding);
+  *out++ = static_cast<char>(file_type);
+  out = std::ranges::copy(base36_digits(count), out).out;
+  return std::ranges::copy(base36_digits(index), out).out;
+}
+
+// Writes the header of part i and encodes its slice of source right after it.
+// out must hold HEADER_LEN + encoded_size() of that slice.
+static void write_part(std::string_view source, Encoding encoding, FileType file_type, int count, int per_each, int i, char* out) {
+  std::string_view chunk = part_source(source, encoding, count, per_each, i);
+  char* payload = write_header(out, encoding, file_type, count, i);
+  if (encoding == Encoding::H) {
+    HexStrTo(chunk, payload);
+  } else {
+    EncodeBase32To(chunk, payload);
+  }
+}
+
+namespace {
+struct SplitPlan {
+  std::string_view source;  // raw data, or the deflated raw data for Z
+  Encoding encoding;
+  int count = 0;
+  int version = 0;
+  int per_each = 0;
+
+  size_t encoded_size() const { return bbqr::encoded_size(encoding, source.size()); }
+  size_t part_size(int i) const {
+    return HEADER_LEN + std::min<size_t>(per_each, encoded_size() - size_t(i) * per_each);
+  }
+  void write_part(FileType file_type, int i, char* out) const {
+    bbqr::write_part(source, encoding, file_type, count, per_each, i, out);
+  }
+};
+}  // namespace
+
+// Deflates raw again with stronger settings while option.compression_tuning_ms
+// (counted from start) lasts, and keeps the output that needs the fewest
+// parts, then the lowest version, then the fewest bytes. A run is only
+// started if the slowest run so far would still fit into the budget.
+static Expected<void> tune_compression(std::string_view raw, const SplitOption& option, std::string& compressed,
+                                       std::chrono::steady_clock::time_point start) {
+  static constexpr DeflateParams CANDIDATES[] = {
+      {.level = 9, .mem_level = 9},
+      {.level = 9, .mem_level = 9, .strategy = DeflateParams::FILTERED},
+      {.level = 9, .mem_level = 9, .strategy = DeflateParams::RLE},
+      {.level = 4, .mem_level = 9},
+  };
+
+  const auto rank = [&](size_t size) {
+    auto best = find_best_version(
+        EncodedBase32Size(size), get_split_mod(Encoding::Z), option.min_split, option.max_split,
+        option.min_version, option.max_version);
+    return best ? std::tuple(std::get<0>(*best), std::get<1>(*best), size) : std::tuple(INT_MAX, INT_MAX, size);
+  };
 
-  auto [encoded, encoding] = encode_data(raw, option.encoding, option.force_encoding);
-  int size = encoded.size();
+  auto deadline = start + std::chrono::milliseconds(option.compression_tuning_ms);
+  auto slowest = std::chrono::steady_clock::now() - start;
+  auto best = rank(compressed.size());
+  std::string candidate;
+  for (const DeflateParams& params : CANDIDATES) {
+    auto run_start = std::chrono::steady_clock::now();
+    if (run_start + slowest > deadline ||
+        (std::get<0>(best) == option.min_split && std::get<1>(best) == option.min_version)) {
+      break;
+    }
+    // anything larger than the best so far can't need fewer parts
+    auto smaller = ZlibCompressor(params).compress(raw, candidate, compressed.size());
+    if (!smaller) {
+      return smaller.error();
+    }
+    if (*smaller && rank(candidate.size()) < best) {
+      best = rank(candidate.size());
+      compressed.swap(candidate);
+    }
+    slowest = std::max(slowest, std::chrono::steady_clock::now() - run_start);
+  }
+  return {};
+}
 
-  auto [count, version, per_each] = find_best_version(
-      size, get_split_mod(encoding), option.min_split, option.max_split,
+Expected<SplitLayout> try_plan_split(size_t encoded_size, Encoding encoding, const SplitOption& option) noexcept {
+  if (auto valid = validateSplitOption(option); !valid) {
+    return valid.error();
+  }
+  if (!is_valid_encoding(encoding)) {
+    return Error::InvalidEncoding;
+  }
+  // also keeps the size within int
+  if (encoded_size > size_t(option.max_split) * (version_to_chars(option.max_version) - HEADER_LEN)) {
+    return Error::CannotFit;
+  }
+
+  auto best = find_best_version(
+      int(encoded_size), get_split_mod(encoding), option.min_split, option.max_split,
       option.min_version, option.max_version);
+  if (!best) {
+    return best.error();
+  }
+  auto [count, version, per_each] = *best;
+  return SplitLayout{.version = version, .count = count, .per_each = per_each, .encoding = encoding};
+}
+
+Expected<SplitLayout> try_plan_for_raw(std::string_view raw, const SplitOption& option) noexcept {
+  if (option.encoding != Encoding::Z) {
+    return try_plan_split(encoded_size(option.encoding, raw.size()), option.encoding, option);
+  }
+  auto deflated = estimate_z_size(raw, option.force_encoding, option.max_compression_ratio);
+  return try_plan_split(EncodedBase32Size(deflated.value_or(raw.size())), deflated ? Encoding::Z : Encoding::Base32, option);
+}
+
+// Plans the split without encoding anything; parts are encoded straight from
+// the source into their own buffers. For Z the raw data is deflated into
+// compressed, which the returned source then points into.
+static Expected<SplitPlan> prepare_split(std::string_view raw, const SplitOption& option, std::string& compressed,
+                                         ZlibCompressor* compressor = nullptr) {
+  if (auto valid = validateSplitOption(option); !valid) {
+    return valid.error();
+  }
+  if (!is_valid_encoding(option.encoding)) {
+    return Error::InvalidEncoding;
+  }
 
-  std::vector<std::string> parts;
-  parts.reserve(count);
+  SplitPlan plan{.source = raw, .encoding = option.encoding};
+  if (option.encoding == Encoding::Z) {
+    auto start = std::chrono::steady_clock::now();
+    CompressionBackend* backend = resolve_backend(option.compression_backend, option.fast_deflate);
+    ZlibCompressor local;
+    auto use_z = backend ? deflate_for_z(*backend, raw, compressed, option.force_encoding, option.max_compression_ratio)
+                         : deflate_for_z(compressor ? *compressor : local, raw, compressed, option.force_encoding,
+                                         option.max_compression_ratio);
+    if (!use_z) {
+      return use_z.error();
+    }
+    // tuning would mix other deflaters' output into a backend's
+    bool tune = *use_z && !backend;
+    if (tune && option.compression_tuning_ms > 0) {
+      if (auto tuned = tune_compression(raw, option, compressed, start); !tuned) {
+        return tuned.error();
+      }
+    }
+    if (tune && option.optimal_deflate_iterations > 0) {
+      std::string optimal;
+      deflate_optimal(raw, optimal, option.optimal_deflate_iterations);
+      if (optimal.size() < compressed.size()) {
+        compressed.swap(optimal);
+      }
+    }
+    if (*use_z) {
+      plan.source = compressed;
+    } else {
+      plan.encoding = Encoding::Base32;
+    }
+  }
 
-  for (int offset = 0, i = 0; offset < size; offset += per_each, ++i) {
-    std::string buff;
-    buff.reserve(HEADER_LEN + per_each);
-    buff.append("B$");
-    buff.push_back(static_cast<char>(encoding));
-    buff.push_back(static_cast<char>(file_type));
-    buff.append(int2base36(count));
-    buff.append(int2base36(i));
-    buff.append(encoded.data() + offset, std::min(per_each, size - offset));
-    parts.emplace_back(std::move(buff));
+  auto layout = try_plan_split(plan.encoded_size(), plan.encoding, option);
+  if (!layout) {
+    return layout.error();
   }
+  plan.count = layout->count;
+  plan.version = layout->version;
+  plan.per_each = layout->per_each;
+  return plan;
+}
+
+// Every part is encoded from its own bytes of the source, so runs of parts
+// can be written on threads of their own.
+static size_t split_workers(const SplitPlan& plan, unsigned threads) {
+  return threads == 1 ? 1 : worker_count(threads, plan.count, plan.encoded_size());
+}
+
+static SplitResult make_split_result(const SplitPlan& plan, FileType file_type, unsigned threads) {
+  std::vector<std::string> parts(plan.count);
+  for_each_run(parts.size(), split_workers(plan, threads), [&](size_t, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      parts[i].resize(plan.part_size(i));
+      plan.write_part(file_type, i, parts[i].data());
+    }
+  });
   return SplitResult{
-      .version = version,
+      .version = plan.version,
       .parts = std::move(parts),
-      .encoding = encoding,
+      .encoding = plan.encoding,
   };
 }
 
-SplitResult split_qrs(const std::vector<unsigned char>& raw, FileType file_type, const SplitOption& option) {
-  return split_qrs(std::string_view(reinterpret_cast<const char*>(raw.data()), raw.size()), file_type, option);
+Expected<SplitResult> try_split_qrs(std::string_view raw, FileType file_type, const SplitOption& option) noexcept {
+  std::string compressed;
+  auto plan = prepare_split(raw, option, compressed);
+  if (!plan) {
+    return plan.error();
+  }
+  return make_split_result(*plan, file_type, option.threads);
+}
+
+Expected<SplitResult> try_split_qrs(const std::vector<unsigned char>& raw, FileType file_type, const SplitOption& option) noexcept {
+  return try_split_qrs(std::string_view(reinterpret_cast<const char*>(raw.data()), raw.size()), file_type, option);
+}
+
+Expected<ArenaSplitResult> try_split_qrs_arena(std::string_view raw, FileType file_type, const SplitOption& option) noexcept {
+  std::string compressed;
+  auto plan = prepare_split(raw, option, compressed);
+  if (!plan) {
+    return plan.error();
+  }
+
+  // The views go first, so they are suitably aligned; the part data follows.
+  size_t count = plan->count;
+  size_t views_size = count * sizeof(std::string_view);
+  auto arena = std::make_unique_for_overwrite<std::byte[]>(views_size + count * HEADER_LEN + plan->encoded_size());
+  auto* views = reinterpret_cast<std::string_view*>(arena.get());
+  char* out = reinterpret_cast<char*>(arena.get() + views_size);
+  // all parts but the last are HEADER_LEN + per_each long
+  for_each_run(count, split_workers(*plan, option.threads), [&](size_t, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      char* part = out + i * (HEADER_LEN + plan->per_each);
+      plan->write_part(file_type, i, part);
+      std::construct_at(views + i, part, plan->part_size(i));
+    }
+  });
+  return ArenaSplitResult{
+      .version = plan->version,
+      .parts = std::span<const std::string_view>(views, count),
+      .encoding = plan->encoding,
+      .arena = std::move(arena),
+  };
+}
+
+Expected<ArenaSplitResult> try_split_qrs_arena(const std::vector<unsigned char>& raw, FileType file_type, const SplitOption& option) noexcept {
+  return try_split_qrs_arena(std::string_view(reinterpret_cast<const char*>(raw.data()), raw.size()), file_type, option);
+}
+
+Expected<LazySplit> try_split_lazy(std::string_view raw, FileType file_type, const SplitOption& option) noexcept {
+  LazySplit split;
+  auto plan = prepare_split(raw, option, split.compressed_);
+  if (!plan) {
+    return plan.error();
+  }
+  split.raw_ = raw;
+  split.file_type_ = file_type;
+  split.encoding_ = plan->encoding;
+  split.count_ = plan->count;
+  split.version_ = plan->version;
+  split.per_each_ = plan->per_each;
+  if (split.encoding_ != Encoding::Z) {
+    split.compressed_ = std::string();  // Z did not pay off
+  }
+  return split;
+}
+
+void LazySplit::write_part(size_t i, std::string& out) const {
+  std::string_view source = encoding_ == Encoding::Z ? std::string_view(compressed_) : raw_;
+  out.resize(HEADER_LEN + encoded_size(encoding_, part_source(source, encoding_, count_, per_each_, i).size()));
+  bbqr::write_part(source, encoding_, file_type_, count_, per_each_, i, out.data());
+}
+
+std::string LazySplit::part(size_t i) const {
+  std::string out;
+  write_part(i, out);
+  return out;
+}
+
+LazySplit::iterator::iterator(const LazySplit* split, size_t index) : split_(split), index_(index) {
+  if (index_ < split_->size()) {
+    split_->write_part(index_, part_);
+  }
+}
+
+LazySplit::iterator& LazySplit::iterator::operator++() {
+  if (++index_ < split_->size()) {
+    split_->write_part(index_, part_);
+  }
+  return *this;
+}
+
+Joiner::Joiner() = default;
+Joiner::~Joiner() = default;
+Joiner::Joiner(Joiner&&) noexcept = default;
+Joiner& Joiner::operator=(Joiner&&) noexcept = default;
+
+Expected<bool> Joiner::try_add_part(std::string_view part) noexcept {
+  if (part.size() <= HEADER_LEN) {
+    return Error::InvalidHeader;
+  }
+
+  auto parsed = parse_header(part);
+  if (!parsed) {
+    return parsed.error();
+  }
+
+  std::string_view header = part.substr(0, 6);
+  if (header_.empty()) {
+    header_ = header;
+    count_ = parsed->count;
+    received_.assign(count_, false);
+  } else if (header != header_) {
+    return Error::ConflictingHeader;
+  }
+
+  size_t idx = parsed->index;
+  std::string_view data = part.substr(HEADER_LEN);
+  if (received_[idx]) {
+    if (auto same = check_duplicate(idx, data); !same) {
+      return same.error();
+    }
+    return false;
+  }
+
+  if (auto stored = store_part(idx, data); !stored) {
+    return reject_part(idx, stored.error());
+  }
+  received_[idx] = true;
+  ++received_count_;
+  if (auto advanced = advance_prefix(); !advanced) {
+    return reject_part(idx, advanced.error());
+  }
+  if (received_count_ == count_) {
+    if (auto finished = finish(); !finished) {
+      return reject_part(idx, finished.error());
+    }
+  }
+  return true;
+}
+
+Error Joiner::reject_part(size_t idx, Error error) {
+  if (received_[idx]) {
+    received_[idx] = false;
+    --received_count_;
+  }
+  // nothing else was accepted, so neither is the header
+  if (received_count_ == 0) {
+    reset();
+    return error;
+  }
+  if (prefix_parts_ > idx) {
+    prefix_parts_ = idx;
+    if (encoding() == Encoding::Z) {
+      // The inflater has taken in the rejected data; rebuild it from the
+      // parts before, which inflated fine the first time
+      prefix_parts_ = 0;
+      inflater_.reset();
+      raw_.clear();
+      static_cast<void>(advance_prefix());
+    }
+  }
+  return error;
+}
+
+#if BBQR_EXCEPTIONS
+bool Joiner::add_part(std::string_view part) {
+  return try_add_part(part).value();
+}
+#endif
+
+Expected<void> Joiner::decode_to_scratch(std::string_view data) {
+  scratch_.resize(max_decoded_size(encoding(), data));
+  auto size = decode_part(encoding(), data, scratch_.data());
+  if (!size) {
+    return size.error();
+  }
+  scratch_.resize(*size);
+  return {};
+}
+
+Expected<void> Joiner::store_part(size_t idx, std::string_view data) {
+  // All parts but the last decode to block_size_ bytes, so each one can be
+  // decoded straight into its final offset as soon as one of them is known.
+  if (idx == count_ - 1) {
+    if (block_size_ == 0 && count_ > 1) {
+      if (auto decoded = decode_to_scratch(data); !decoded) {
+        return decoded.error();
+      }
+      pending_last_ = data;
+      return {};
+    }
+    return store_last_part(data);
+  }
+
+  if (block_size_ == 0) {
+    if (auto decoded = decode_to_scratch(data); !decoded) {
+      return decoded.error();
+    }
+    if (scratch_.empty()) {
+      return Error::InconsistentPartLength;
+    }
+    part_len_ = data.size();
+    block_size_ = scratch_.size();
+    buffer_.resize(count_ * block_size_);
+    std::copy(scratch_.begin(), scratch_.end(), buffer_.begin() + idx * block_size_);
+    if (!pending_last_.empty()) {
+      std::string last = std::move(pending_last_);
+      pending_last_ = std::string();
+      return store_last_part(last);
+    }
+    return {};
+  }
+
+  if (data.size() != part_len_) {
+    return Error::InconsistentPartLength;
+  }
+  unsigned char* out = buffer_.data() + idx * block_size_;
+  size_t size;
+  if (max_decoded_size(encoding(), data) <= block_size_) {
+    auto decoded = decode_part(encoding(), data, out);
+    if (!decoded) {
+      return decoded.error();
+    }
+    size = *decoded;
+  } else {
+    if (auto decoded = decode_to_scratch(data); !decoded) {
+      return decoded.error();
+    }
+    size = scratch_.size();
+    std::copy_n(scratch_.begin(), std::min(size, block_size_), out);
+  }
+  if (size != block_size_) {
+    return Error::InconsistentPartLength;
+  }
+  return {};
+}
+
+Expected<void> Joiner::store_last_part(std::string_view data) {
+  if (auto decoded = decode_to_scratch(data); !decoded) {
+    return decoded.error();
+  }
+  size_t offset = (count_ - 1) * block_size_;
+  buffer_.resize(offset + scratch_.size());
+  std::copy(scratch_.begin(), scratch_.end(), buffer_.begin() + offset);
+  return {};
+}
+
+Expected<void> Joiner::check_duplicate(size_t idx, std::string_view data) {
+  bool same;
+  if (idx == count_ - 1 && block_size_ == 0 && count_ > 1) {
+    same = pending_last_ == data;
+  } else {
+    if (auto decoded = decode_to_scratch(data); !decoded) {
+      return decoded.error();
+    }
+    size_t offset = idx * block_size_;
+    size_t size = idx == count_ - 1 ? buffer_.size() - offset : block_size_;
+    same = std::equal(scratch_.begin(), scratch_.end(), buffer_.begin() + offset, buffer_.begin() + offset + size);
+  }
+  if (!same) {
+    return Error::DuplicateMismatch;
+  }
+  return {};
+}
+
+std::vector<unsigned char>& Joiner::decoded() {
+  return encoding() == Encoding::Z ? raw_ : buffer_;
+}
+
+const std::vector<unsigned char>& Joiner::decoded() const {
+  return encoding() == Encoding::Z ? raw_ : buffer_;
+}
+
+Expected<void> Joiner::advance_prefix() {
+  size_t begin = prefix_parts_;
+  while (prefix_parts_ < count_ && received_[prefix_parts_]) {
+    ++prefix_parts_;
+  }
+  if (encoding() != Encoding::Z || begin == prefix_parts_) {
+    return {};
+  }
+
+  // The compressed bytes of parts [begin, prefix_parts_) are contiguous in
+  // buffer_, so they can be handed to the inflater in one go.
+  if (!inflater_) {
+    inflater_ = std::make_unique<Inflater>();
+  }
+  size_t offset = begin * block_size_;
+  size_t end = prefix_parts_ == count_ ? buffer_.size() : prefix_parts_ * block_size_;
+  auto fed = inflater_->feed(std::span(buffer_).subspan(offset, end - offset), raw_);
+  if (!fed) {
+    return fed.error();
+  }
+  return {};
+}
+
+std::span<const unsigned char> Joiner::prefix() const {
+  if (count_ == 0) {
+    return {};
+  }
+  if (encoding() == Encoding::Z) {
+    return raw_;
+  }
+  size_t size = prefix_parts_ == count_ ? buffer_.size() : prefix_parts_ * block_size_;
+  return std::span(buffer_).first(size);
+}
+
+Expected<void> Joiner::finish() {
+  if (encoding() == Encoding::Z) {
+    if (!inflater_->is_finished()) {
+      return Error::DecompressionFailed;  // truncated deflate stream
+    }
+    inflater_.reset();
+  }
+  complete_ = true;
+  return {};
+}
+
+float Joiner::progress() const {
+  return count_ == 0 ? 0.0f : static_cast<float>(received_count_) / count_;
+}
+
+FileType Joiner::file_type() const {
+  return header_.empty() ? FileType{} : static_cast<FileType>(header_[3]);
+}
+
+Encoding Joiner::encoding() const {
+  return header_.empty() ? Encoding{} : static_cast<Encoding>(header_[2]);
+}
+
+template <typename RawType>
+JoinResult<RawType> Joiner::result() const& {
+  return JoinResult<RawType>{
+      .file_type = file_type(),
+      .encoding = encoding(),
+      .raw = complete_ ? RawType(decoded().begin(), decoded().end()) : RawType{},
+      .expected_part_count = count_,
+      .processed_parts_count = received_count_,
+      .is_complete = complete_,
+  };
 }
 
 template <typename RawType>
-JoinResult<RawType> join_qrs(const std::vector<std::string>& parts) {
+JoinResult<RawType> Joiner::result() && {
+  if constexpr (std::is_same_v<RawType, std::vector<unsigned char>>) {
+    return JoinResult<RawType>{
+        .file_type = file_type(),
+        .encoding = encoding(),
+        .raw = complete_ ? std::move(decoded()) : RawType{},
+        .expected_part_count = count_,
+        .processed_parts_count = received_count_,
+        .is_complete = complete_,
+    };
+  } else {
+    return static_cast<const Joiner&>(*this).result<RawType>();
+  }
+}
+
+void Joiner::reset() {
+  *this = Joiner();
+}
+
+template JoinResult<std::vector<unsigned char>> Joiner::result() const&;
+template JoinResult<std::string> Joiner::result() const&;
+template JoinResult<std::vector<unsigned char>> Joiner::result() &&;
+template JoinResult<std::string> Joiner::result() &&;
+
+MultiJoiner::MultiJoiner(size_t max_sessions, CompletionCallback on_complete)
+    : max_sessions_(std::max<size_t>(max_sessions, 1)), on_complete_(std::move(on_complete)) {}
+
+Expected<bool> MultiJoiner::try_add_part(std::string_view part) {
+  if (auto parsed = parse_header(part); !parsed) {
+    return parsed.error();
+  }
+
+  std::string_view header = part.substr(0, 6);
+  auto it = std::find_if(sessions_.begin(), sessions_.end(),
+                         [&](const Session& session) { return session.header == header; });
+  Expected<bool> added = true;
+  bool completed = false;
+  if (it == sessions_.end()) {
+    Joiner joiner;
+    if (added = joiner.try_add_part(part); !added) {
+      return added.error();
+    }
+
+    if (sessions_.size() >= max_sessions_) {
+      auto lru = std::min_element(sessions_.begin(), sessions_.end(),
+                                  [](const Session& a, const Session& b) { return a.last_used < b.last_used; });
+      sessions_.erase(lru);
+    }
+    sessions_.push_back(Session{
+        .header = std::string(header),
+        .joiner = std::move(joiner),
+        .last_used = ++clock_,
+    });
+    it = sessions_.end() - 1;
+    completed = it->joiner.is_complete();
+  } else {
+    it->last_used = ++clock_;
+    bool was_complete = it->joiner.is_complete();
+    added = it->joiner.try_add_part(part);
+    completed = added && !was_complete && it->joiner.is_complete();
+  }
+
+  // last, so that an exception from the callback leaves the part added
+  if (completed && on_complete_) {
+    on_complete_(it->joiner);
+  }
+  return added;
+}
+
+#if BBQR_EXCEPTIONS
+bool MultiJoiner::add_part(std::string_view part) {
+  return try_add_part(part).value();
+}
+#endif
+
+const Joiner* MultiJoiner::find(std::string_view header) const {
+  auto it = std::find_if(sessions_.begin(), sessions_.end(),
+                         [&](const Session& session) { return session.header == header; });
+  return it == sessions_.end() ? nullptr : &it->joiner;
+}
+
+void MultiJoiner::erase(std::string_view header) {
+  std::erase_if(sessions_, [&](const Session& session) { return session.header == header; });
+}
+
+namespace {
+struct CollectedParts {
+  PartHeader header;
+  std::vector<std::string_view> payloads;  // by part index, empty if missing
+  size_t received = 0;
+};
+}  // namespace
+
+// Whether two payloads of one part decode to the same bytes, as Joiner
+// compares duplicates. Their text can differ in case or hex whitespace.
+static Expected<bool> same_payload(Encoding encoding, std::string_view a, std::string_view b) {
+  if (a == b) {
+    return true;
+  }
+  std::vector<unsigned char> decoded_a(max_decoded_size(encoding, a)), decoded_b(max_decoded_size(encoding, b));
+  auto size_a = decode_part(encoding, a, decoded_a.data());
+  if (!size_a) {
+    return size_a.error();
+  }
+  auto size_b = decode_part(encoding, b, decoded_b.data());
+  if (!size_b) {
+    return size_b.error();
+  }
+  return std::ranges::equal(std::span(decoded_a).first(*size_a), std::span(decoded_b).first(*size_b));
+}
+
+// Validates the headers of parts and orders their payloads, without copying.
+static Expected<CollectedParts> collect_parts(const std::vector<std::string>& parts) {
+  if (parts.empty()) {
+    return Error::InvalidHeader;
+  }
+
+  CollectedParts collected;
   std::string_view header;
   for (auto&& part : parts) {
     if (part.size() <= HEADER_LEN) {
-      throw std::invalid_argument("Invalid header data");
+      return Error::InvalidHeader;
+    }
+    auto parsed = parse_header(part);
+    if (!parsed) {
+      return parsed.error();
     }
     if (header.empty()) {
-      header = std::string_view(part.data(), 6);
-    } else if (std::string_view(part.data(), 6) != header) {
-      throw std::invalid_argument("conflicting/variable filetype/encodings/sizes");
+      header = std::string_view(part).substr(0, 6);
+      collected.header = *parsed;
+      collected.payloads.resize(parsed->count);
+    } else if (std::string_view(part).substr(0, 6) != header) {
+      return Error::ConflictingHeader;
+    }
+
+    std::string_view payload = std::string_view(part).substr(HEADER_LEN);
+    std::string_view& slot = collected.payloads[parsed->index];
+    if (slot.empty()) {
+      slot = payload;
+      ++collected.received;
+    } else if (auto same = same_payload(parsed->encoding, slot, payload); !same) {
+      return same.error();
+    } else if (!*same) {
+      return Error::DuplicateMismatch;
     }
   }
-  if (header.substr(0, 2) != "B$") {
-    throw std::invalid_argument("fixed header not found, expected B$");
+
+  // all parts but the last must be equally long
+  std::string_view first;
+  for (size_t i = 0; i + 1 < collected.payloads.size(); ++i) {
+    std::string_view payload = collected.payloads[i];
+    if (first.empty()) {
+      first = payload;
+    } else if (!payload.empty() && payload.size() != first.size()) {
+      return Error::InconsistentPartLength;
+    }
   }
+  return collected;
+}
 
-  Encoding encoding = static_cast<Encoding>(header[2]);
-  FileType file_type = static_cast<FileType>(header[3]);
-  size_t count = std::stoi(std::string(header.substr(4, 2)), nullptr, 36);
+// try_decode_data() for H and Base32, on up to threads threads
+template <typename RawType>
+static Expected<RawType> decode_in_parallel(const std::vector<std::string_view>& payloads, Encoding encoding, unsigned threads) {
+  auto size = decoded_size_upper_bound(payloads, encoding);
+  if (!size) {
+    return size.error();
+  }
+  RawType raw;
+  raw.resize(*size);
+  auto decoded = decode_parts_parallel(payloads, encoding, std::span(reinterpret_cast<unsigned char*>(raw.data()), raw.size()), threads);
+  if (!decoded) {
+    return decoded.error();
+  }
+  raw.resize(*decoded);
+  return raw;
+}
 
-  if (count == 0) {
-    throw std::invalid_argument("Invalid QR");
+// try_decode_data(), with H and Base32 on up to threads threads and Z
+// inflated by backend if there is one
+template <typename RawType>
+static Expected<RawType> decode_with_backend(CompressionBackend* backend, const std::vector<std::string_view>& payloads,
+                                             Encoding encoding, unsigned threads) {
+  if (encoding != Encoding::Z) {
+    return threads == 1 ? try_decode_data<RawType>(payloads, encoding) : decode_in_parallel<RawType>(payloads, encoding, threads);
   }
+  if (!backend) {
+    return try_decode_data<RawType>(payloads, encoding);
+  }
+  RawType raw;
+  if (auto inflated = uncompress_base32(*backend, payloads, raw); !inflated) {
+    return inflated.error();
+  }
+  return raw;
+}
 
-  std::vector<std::pair<int, std::string_view>> data;
-  data.reserve(parts.size());
+// Joins parts by decoding all payloads at once, with decode(payloads, encoding)
+template <typename RawType, typename Decode>
+static Expected<JoinResult<RawType>> join_collected(const std::vector<std::string>& parts, Decode&& decode) {
+  auto collected = collect_parts(parts);
+  if (!collected) {
+    return collected.error();
+  }
 
+  const auto& header = collected->header;
+  RawType raw;
+  bool is_complete = collected->received == collected->payloads.size();
+  if (is_complete) {
+    auto decoded = decode(collected->payloads, header.encoding);
+    if (!decoded) {
+      return decoded.error();
+    }
+    raw = std::move(*decoded);
+  }
+  return JoinResult<RawType>{
+      .file_type = header.file_type,
+      .encoding = header.encoding,
+      .raw = std::move(raw),
+      .expected_part_count = collected->payloads.size(),
+      .processed_parts_count = collected->received,
+      .is_complete = is_complete,
+  };
+}
+
+template <typename RawType>
+Expected<JoinResult<RawType>> try_join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) noexcept {
+  if (parts.empty()) {
+    return Error::InvalidHeader;
+  }
+
+  // Joiner inflates Z with zlib as the parts come in; a backend needs the
+  // whole stream, and so do threads
+  if ((backend = resolve_backend(backend)) || threads != 1) {
+    return join_collected<RawType>(parts, [&](const std::vector<std::string_view>& payloads, Encoding encoding) {
+      return decode_with_backend<RawType>(backend, payloads, encoding, threads);
+    });
+  }
+
+  Joiner joiner;
   for (auto&& part : parts) {
-    size_t idx = std::stoi(part.substr(6, 2), nullptr, 36);
-    if (idx >= count) {
-      throw std::invalid_argument("got part " + std::to_string(idx) + " but only expecting " + std::to_string(count));
+    if (auto added = joiner.try_add_part(part); !added) {
+      return added.error();
     }
-    data.emplace_back(idx, std::string_view(part.data() + 8, part.size() - 8));
   }
+  return std::move(joiner).result<RawType>();
+}
 
-  std::sort(data.begin(), data.end());
-  data.erase(std::unique(data.begin(), data.end()), data.end());
+template Expected<JoinResult<std::vector<unsigned char>>> try_join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) noexcept;
+template Expected<JoinResult<std::string>> try_join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) noexcept;
 
-  if (data.size() == count) {
-    std::vector<std::string_view> encoded(data.size());
-    std::transform(data.begin(), data.end(), encoded.begin(),
-                   [](const std::pair<int, std::string_view>& p) { return p.second; });
-    auto decoded = decode_data<RawType>(encoded, encoding);
-    return JoinResult<RawType>{
-        .file_type = file_type,
-        .encoding = encoding,
-        .raw = std::move(decoded),
-        .expected_part_count = count,
-        .processed_parts_count = count,
-        .is_complete = true,
-    };
+Expected<size_t> decoded_size_upper_bound(const std::vector<std::string>& parts) noexcept {
+  auto collected = collect_parts(parts);
+  if (!collected) {
+    return collected.error();
   }
 
-  if (data.size() < count) {
-    return JoinResult<RawType>{
-        .file_type = file_type,
-        .encoding = encoding,
-        .raw = (RawType{}),
-        .expected_part_count = count,
-        .processed_parts_count = data.size(),
-        .is_complete = false,
-    };
+  const auto& payloads = collected->payloads;
+  if (collected->received == payloads.size()) {
+    return decoded_size_upper_bound(payloads, collected->header.encoding);
+  }
+  if (collected->header.encoding == Encoding::Z) {
+    return Error::MissingParts;
+  }
+
+  // Every part decodes to at most as much as the (equally long) others
+  auto part = std::find_if(payloads.begin(), payloads.end() - 1, [](std::string_view p) { return !p.empty(); });
+  if (part == payloads.end() - 1) {
+    return Error::MissingParts;
+  }
+  return payloads.size() * max_decoded_size(collected->header.encoding, *part);
+}
+
+Expected<JoinResult<std::span<std::byte>>> try_join_into(const std::vector<std::string>& parts, std::span<std::byte> out, unsigned threads) noexcept {
+  auto collected = collect_parts(parts);
+  if (!collected) {
+    return collected.error();
+  }
+
+  const auto& header = collected->header;
+  size_t size = 0;
+  bool is_complete = collected->received == collected->payloads.size();
+  if (is_complete) {
+    auto decoded = threads != 1 && header.encoding != Encoding::Z
+                       ? decode_parts_parallel(collected->payloads, header.encoding,
+                                               std::span(reinterpret_cast<unsigned char*>(out.data()), out.size()), threads)
+                       : try_decode_into(collected->payloads, header.encoding, out);
+    if (!decoded) {
+      return decoded.error();
+    }
+    size = *decoded;
+  }
+  return JoinResult<std::span<std::byte>>{
+      .file_type = header.file_type,
+      .encoding = header.encoding,
+      .raw = out.first(size),
+      .expected_part_count = collected->payloads.size(),
+      .processed_parts_count = collected->received,
+      .is_complete = is_complete,
+  };
+}
+
+struct Codec::State {
+  ZlibCompressor compressor;
+  ZlibDecompressor decompressor;
+  std::string compressed;             // deflate output
+  std::vector<unsigned char> output;  // inflate output
+};
+
+Codec::Codec() : state_(std::make_unique<State>()) {}
+Codec::~Codec() = default;
+Codec::Codec(Codec&&) noexcept = default;
+Codec& Codec::operator=(Codec&&) noexcept = default;
+
+Expected<SplitResult> Codec::try_split_qrs(std::string_view raw, FileType file_type, const SplitOption& option) noexcept {
+  auto plan = prepare_split(raw, option, state_->compressed, &state_->compressor);
+  if (!plan) {
+    return plan.error();
+  }
+  return make_split_result(*plan, file_type, option.threads);
+}
+
+template <typename RawType>
+Expected<JoinResult<RawType>> Codec::try_join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) noexcept {
+  if ((backend = resolve_backend(backend))) {
+    return join_collected<RawType>(parts, [&](const std::vector<std::string_view>& payloads, Encoding encoding) {
+      return decode_with_backend<RawType>(backend, payloads, encoding, threads);
+    });
+  }
+  return join_collected<RawType>(parts, [&](const std::vector<std::string_view>& payloads, Encoding encoding) {
+    if (encoding == Encoding::Z) {
+      // through this codec's reused decompressor and output buffer
+      return this->try_decode_data<RawType>(payloads, encoding);
+    }
+    if (threads != 1) {
+      return decode_in_parallel<RawType>(payloads, encoding, threads);
+    }
+    return bbqr::try_decode_data<RawType>(payloads, encoding);
+  });
+}
+
+Expected<std::pair<std::string, Encoding>> Codec::try_encode_data(std::string_view raw, Encoding encoding, bool force_encoding) noexcept {
+  if (encoding != Encoding::Z) {
+    return bbqr::try_encode_data(raw, encoding, force_encoding);
   }
 
-  throw std::invalid_argument("Duplicate part has wrong content");
+  std::string& compressed = state_->compressed;
+  CompressionBackend* backend = resolve_backend(nullptr);
+  auto use_z = backend ? deflate_for_z(*backend, raw, compressed, force_encoding)
+                       : deflate_for_z(state_->compressor, raw, compressed, force_encoding);
+  if (!use_z) {
+    return use_z.error();
+  }
+  return *use_z ? std::make_pair(EncodeBase32(compressed), Encoding::Z)
+                : std::make_pair(EncodeBase32(raw), Encoding::Base32);
+}
+
+template <typename RawType>
+Expected<RawType> Codec::try_decode_data(const std::vector<std::string_view>& parts, Encoding encoding) noexcept {
+  if (encoding != Encoding::Z) {
+    return bbqr::try_decode_data<RawType>(parts, encoding);
+  }
+
+  auto& output = state_->output;
+  CompressionBackend* backend = resolve_backend(nullptr);
+  auto inflated = backend ? uncompress_base32(*backend, parts, output) : state_->decompressor.uncompress_base32(parts, output);
+  if (!inflated) {
+    return inflated.error();
+  }
+  return RawType(output.begin(), output.end());
+}
+
+template Expected<JoinResult<std::vector<unsigned char>>> Codec::try_join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) noexcept;
+template Expected<JoinResult<std::string>> Codec::try_join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) noexcept;
+template Expected<std::vector<unsigned char>> Codec::try_decode_data(const std::vector<std::string_view>& parts, Encoding encoding) noexcept;
+template Expected<std::string> Codec::try_decode_data(const std::vector<std::string_view>& parts, Encoding encoding) noexcept;
+
+#if BBQR_EXCEPTIONS
+SplitResult split_qrs(std::string_view raw, FileType file_type, const SplitOption& option) {
+  return try_split_qrs(raw, file_type, option).value();
+}
+
+SplitResult split_qrs(const std::vector<unsigned char>& raw, FileType file_type, const SplitOption& option) {
+  return try_split_qrs(raw, file_type, option).value();
+}
+
+ArenaSplitResult split_qrs_arena(std::string_view raw, FileType file_type, const SplitOption& option) {
+  return try_split_qrs_arena(raw, file_type, option).value();
+}
+
+ArenaSplitResult split_qrs_arena(const std::vector<unsigned char>& raw, FileType file_type, const SplitOption& option) {
+  return try_split_qrs_arena(raw, file_type, option).value();
+}
+
+LazySplit split_lazy(std::string_view raw, FileType file_type, const SplitOption& option) {
+  return try_split_lazy(raw, file_type, option).value();
+}
+
+SplitLayout plan_split(size_t encoded_size, Encoding encoding, const SplitOption& option) {
+  return try_plan_split(encoded_size, encoding, option).value();
+}
+
+SplitLayout plan_for_raw(std::string_view raw, const SplitOption& option) {
+  return try_plan_for_raw(raw, option).value();
+}
+
+template <typename RawType>
+JoinResult<RawType> join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) {
+  return try_join_qrs<RawType>(parts, backend, threads).value();
+}
+
+template JoinResult<std::vector<unsigned char>> join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads);
+template JoinResult<std::string> join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads);
+
+JoinResult<std::span<std::byte>> join_into(const std::vector<std::string>& parts, std::span<std::byte> out, unsigned threads) {
+  return try_join_into(parts, out, threads).value();
+}
+
+SplitResult Codec::split_qrs(std::string_view raw, FileType file_type, const SplitOption& option) {
+  return try_split_qrs(raw, file_type, option).value();
+}
+
+template <typename RawType>
+JoinResult<RawType> Codec::join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads) {
+  return try_join_qrs<RawType>(parts, backend, threads).value();
 }
 
-template JoinResult<std::vector<unsigned char>> join_qrs(const std::vector<std::string>& parts);
-template JoinResult<std::string> join_qrs(const std::vector<std::string>& parts);
+template JoinResult<std::vector<unsigned char>> Codec::join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads);
+template JoinResult<std::string> Codec::join_qrs(const std::vector<std::string>& parts, CompressionBackend* backend, unsigned threads);
+#endif
 
 }  // namespace bbqr
@@ -0,0 +1,469 @@
+#include "compression.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include "strencoding.hpp"
+#include "zlib.h"
+
+namespace bbqr {
+static_assert(DeflateParams().level == Z_DEFAULT_COMPRESSION && DeflateParams::DEFAULT == Z_DEFAULT_STRATEGY &&
+              DeflateParams::FILTERED == Z_FILTERED && DeflateParams::RLE == Z_RLE);
+
+struct ZlibCompressor::State {
+  DeflateParams params;
+  z_stream stream;
+  bool initialized = false;
+};
+
+ZlibCompressor::ZlibCompressor(DeflateParams params) : state_(std::make_unique<State>()) {
+  state_->params = params;
+}
+
+ZlibCompressor::~ZlibCompressor() {
+  if (state_->initialized) {
+    deflateEnd(&state_->stream);
+  }
+}
+
+Expected<void> ZlibCompressor::compress(std::string_view source, std::string &out) noexcept {
+  auto compressed = compress(source, out, std::numeric_limits<size_t>::max());
+  if (!compressed) {
+    return compressed.error();
+  }
+  return {};
+}
+
+Expected<bool> ZlibCompressor::compress(std::string_view source, std::string &out, size_t max_size) noexcept {
+  static constexpr size_t MIN_BUFFER_SIZE = 64;
+
+  z_stream &stream = state_->stream;
+  if (state_->initialized) {
+    if (deflateReset(&stream) != Z_OK) {
+      return Error::CompressionFailed;
+    }
+  } else {
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+    const DeflateParams &params = state_->params;
+    if (deflateInit2(&stream, params.level, Z_DEFLATED, -10, params.mem_level,
+                     params.strategy) != Z_OK) {
+      return Error::CompressionFailed;
+    }
+    state_->initialized = true;
+  }
+
+  out.resize(std::min(std::max({out.capacity(), source.size(), MIN_BUFFER_SIZE}), max_size));
+  stream.next_out = (Bytef *)(out.data());
+  stream.avail_out = out.size();
+  stream.next_in = (Bytef *)(source.data());
+  stream.avail_in = source.size();
+
+  while (true) {
+    int ret = deflate(&stream, Z_FINISH);
+    if (ret == Z_STREAM_END) {
+      break;
+    } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+      auto size = out.size();
+      if (size >= max_size) {
+        return false;
+      }
+      out.resize(std::min(size * 2, max_size));
+      stream.next_out = (Bytef *)(out.data() + stream.total_out);
+      stream.avail_out = out.size() - size;
+    } else {
+      return Error::CompressionFailed;
+    }
+  }
+
+  out.resize(stream.total_out);
+  return true;
+}
+
+// Shannon entropy in bits per byte of the sample
+static double byte_entropy(std::string_view sample) {
+  std::array<size_t, 256> counts{};
+  for (unsigned char c : sample) {
+    ++counts[c];
+  }
+  double sum = 0;
+  for (size_t count : counts) {
+    if (count > 0) {
+      sum += count * std::log2(double(count));
+    }
+  }
+  return std::log2(double(sample.size())) - sum / sample.size();
+}
+
+// True if raw can't be deflated below limit bytes, or a sample of it looks
+// like random data
+static bool skip_deflate(std::string_view raw, size_t limit) {
+  // Random 4 KB measure about 7.95 bits/byte; signed transactions, the
+  // densest data BBQr usually carries, stay below 7.8 and still deflate well.
+  static constexpr size_t PROBE_SIZE = 4096;
+  static constexpr double INCOMPRESSIBLE_ENTROPY = 7.9;
+
+  return limit == 0 || (raw.size() >= PROBE_SIZE && byte_entropy(raw.substr(0, PROBE_SIZE)) > INCOMPRESSIBLE_ENTROPY);
+}
+
+Expected<bool> deflate_for_z(ZlibCompressor &compressor, std::string_view raw, std::string &out, bool force,
+                             double max_ratio) noexcept {
+  if (force) {
+    if (auto compressed = compressor.compress(raw, out); !compressed) {
+      return compressed.error();
+    }
+    return true;
+  }
+
+  size_t limit = max_ratio * raw.size();
+  if (skip_deflate(raw, limit)) {
+    return false;
+  }
+  return compressor.compress(raw, out, limit - 1);
+}
+
+Expected<bool> deflate_for_z(CompressionBackend &backend, std::string_view raw, std::string &out, bool force,
+                             double max_ratio) noexcept {
+  size_t limit = max_ratio * raw.size();
+  if (!force && skip_deflate(raw, limit)) {
+    return false;
+  }
+  if (auto compressed = backend.compress(raw, out); !compressed) {
+    return compressed.error();
+  }
+  return force || out.size() < limit;
+}
+
+std::optional<size_t> estimate_z_size(std::string_view raw, bool force, double max_ratio) noexcept {
+  // Matches reach back 1 KB at most, so a few 4 KB slices deflate about as
+  // well as the whole; they are deflated together to pay for one block header
+  static constexpr size_t SAMPLE_COUNT = 16;
+  static constexpr size_t SAMPLE_SIZE = 4096;
+
+  size_t limit = max_ratio * raw.size();
+  if (!force && skip_deflate(raw, limit)) {
+    return std::nullopt;
+  }
+
+  std::string sample, compressed;
+  std::string_view source = raw;
+  if (raw.size() > SAMPLE_COUNT * SAMPLE_SIZE) {
+    sample.reserve(SAMPLE_COUNT * SAMPLE_SIZE);
+    for (size_t i = 0; i < SAMPLE_COUNT; ++i) {
+      sample += raw.substr((raw.size() - SAMPLE_SIZE) / (SAMPLE_COUNT - 1) * i, SAMPLE_SIZE);
+    }
+    source = sample;
+  }
+  deflate_fast(source, compressed);
+  size_t size = source.size() == raw.size() ? compressed.size()
+                                            : size_t(double(compressed.size()) * raw.size() / source.size());
+  if (!force && size >= limit) {
+    return std::nullopt;
+  }
+  return size;
+}
+
+struct ZlibDecompressor::State {
+  z_stream stream;
+  bool initialized = false;
+  bool try_fast_inflate = true;
+};
+
+ZlibDecompressor::ZlibDecompressor(bool try_fast_inflate) : state_(std::make_unique<State>()) {
+  state_->try_fast_inflate = try_fast_inflate;
+}
+
+ZlibDecompressor::~ZlibDecompressor() {
+  if (state_->initialized) {
+    inflateEnd(&state_->stream);
+  }
+}
+
+Expected<void> ZlibDecompressor::reset() noexcept {
+  z_stream &stream = state_->stream;
+  if (state_->initialized) {
+    if (inflateReset(&stream) != Z_OK) {
+      return Error::DecompressionFailed;
+    }
+  } else {
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+    stream.next_in = Z_NULL;
+    stream.avail_in = 0;
+    if (inflateInit2(&stream, -10) != Z_OK) {
+      return Error::DecompressionFailed;
+    }
+    state_->initialized = true;
+  }
+  return {};
+}
+
+template <typename Buffer>
+Expected<void> ZlibDecompressor::uncompress(std::span<const unsigned char> source, Buffer &out) noexcept {
+  static constexpr size_t INITIAL_BUFFER_SIZE = 1024;
+  if (state_->try_fast_inflate && fast_inflate(source, out)) {
+    return {};
+  }
+
+  if (auto reset = this->reset(); !reset) {
+    return reset.error();
+  }
+
+  z_stream &stream = state_->stream;
+  out.resize(std::max(out.capacity(), INITIAL_BUFFER_SIZE));
+  stream.next_out = (Bytef *)(out.data());
+  stream.avail_out = out.size();
+  stream.next_in = (Bytef *)(source.data());
+  stream.avail_in = source.size();
+
+  while (true) {
+    int ret = inflate(&stream, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      break;
+    } else if (ret == Z_BUF_ERROR && stream.avail_out == 0) {
+      auto size = out.size();
+      out.resize(size * 2);
+      stream.next_out = (Bytef *)(out.data() + stream.total_out);
+      stream.avail_out = out.size() - size;
+    } else if (ret != Z_OK) {
+      // includes Z_BUF_ERROR with output space left: the input is truncated
+      return Error::DecompressionFailed;
+    }
+  }
+
+  out.resize(stream.total_out);
+  return {};
+}
+
+template <typename Buffer>
+Expected<void> ZlibDecompressor::uncompress_base32(std::span<const std::string_view> parts, Buffer &out) noexcept {
+  static constexpr size_t INITIAL_BUFFER_SIZE = 1024;
+  // 8 base32 chars decode to 5 whole bytes, so chunks stay byte aligned
+  static constexpr size_t CHUNK_CHARS = 8 * 512;
+  unsigned char chunk[CHUNK_CHARS / 8 * 5];
+  if (state_->try_fast_inflate && fast_inflate_base32(parts, out)) {
+    return {};
+  }
+
+  if (auto reset = this->reset(); !reset) {
+    return reset.error();
+  }
+
+  z_stream &stream = state_->stream;
+  out.resize(std::max(out.capacity(), INITIAL_BUFFER_SIZE));
+  stream.next_out = (Bytef *)(out.data());
+  stream.avail_out = out.size();
+
+  int ret = Z_OK;
+  // Inflates until the pending input is used up; with flush set, until the
+  // stream ends
+  const auto run = [&](bool flush) -> Expected<void> {
+    while (ret != Z_STREAM_END && (flush || stream.avail_in > 0)) {
+      if (stream.avail_out == 0) {
+        auto size = out.size();
+        out.resize(size * 2);
+        stream.next_out = (Bytef *)(out.data() + stream.total_out);
+        stream.avail_out = out.size() - size;
+      }
+      ret = inflate(&stream, Z_NO_FLUSH);
+      if (ret == Z_BUF_ERROR && stream.avail_out != 0) {
+        return Error::DecompressionFailed;  // the input is truncated
+      } else if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+        return Error::DecompressionFailed;
+      }
+    }
+    return {};
+  };
+
+  for (auto part = parts.begin(); part != parts.end() && ret != Z_STREAM_END; ++part) {
+    for (size_t pos = 0; pos < part->size() && ret != Z_STREAM_END; pos += CHUNK_CHARS) {
+      auto size = DecodeBase32To(part->substr(pos, CHUNK_CHARS), chunk);
+      if (!size) {
+        return Error::InvalidBase32;
+      }
+      stream.next_in = chunk;
+      stream.avail_in = *size;
+      if (auto inflated = run(false); !inflated) {
+        return inflated.error();
+      }
+    }
+  }
+  if (auto inflated = run(true); !inflated) {
+    return inflated.error();
+  }
+
+  out.resize(stream.total_out);
+  return {};
+}
+
+template <typename Buffer>
+Expected<void> uncompress_base32(CompressionBackend &backend, std::span<const std::string_view> parts, Buffer &out) noexcept {
+  size_t size = 0;
+  for (auto part : parts) {
+    size += DecodedBase32Size(part);
+  }
+  std::vector<unsigned char> compressed(size);
+  size_t offset = 0;
+  for (auto part : parts) {
+    auto decoded = DecodeBase32To(part, compressed.data() + offset);
+    if (!decoded) {
+      return Error::InvalidBase32;
+    }
+    offset += *decoded;
+  }
+  compressed.resize(offset);
+
+  if constexpr (std::is_same_v<Buffer, std::vector<unsigned char>>) {
+    return backend.decompress(compressed, out);
+  } else {
+    std::vector<unsigned char> inflated;
+    if (auto decompressed = backend.decompress(compressed, inflated); !decompressed) {
+      return decompressed.error();
+    }
+    out.assign(inflated.begin(), inflated.end());
+    return {};
+  }
+}
+
+Expected<size_t> inflate_base32(std::span<const std::string_view> parts, std::span<unsigned char> out, bool discard) noexcept {
+  // 8 base32 chars decode to 5 whole bytes, so chunks stay byte aligned
+  static constexpr size_t CHUNK_CHARS = 8 * 512;
+  unsigned char chunk[CHUNK_CHARS / 8 * 5];
+
+  z_stream stream;
+  stream.zalloc = (alloc_func)0;
+  stream.zfree = (free_func)0;
+  stream.opaque = (voidpf)0;
+  stream.next_in = Z_NULL;
+  stream.avail_in = 0;
+  stream.next_out = (Bytef *)(out.data());
+  stream.avail_out = out.size();
+  if ((discard && out.empty()) || inflateInit2(&stream, -10) != Z_OK) {
+    return Error::DecompressionFailed;
+  }
+
+  size_t discarded = 0;
+  int ret = Z_OK;
+  // Inflates until no progress is possible without more input, or the stream
+  // ends. Only once all input is in (last set) is that an error: out is full,
+  // or the input is truncated.
+  const auto run = [&](bool last) -> Expected<void> {
+    while (true) {
+      if (discard && stream.avail_out == 0) {
+        discarded += out.size();
+        stream.next_out = (Bytef *)(out.data());
+        stream.avail_out = out.size();
+      }
+      ret = inflate(&stream, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END) {
+        return {};
+      } else if (ret == Z_BUF_ERROR) {
+        if (stream.avail_in == 0 && !last) {
+          return {};  // the next chunk may end the stream, even with out full
+        }
+        return stream.avail_out == 0 ? Error::BufferTooSmall : Error::DecompressionFailed;
+      } else if (ret != Z_OK) {
+        return Error::DecompressionFailed;
+      }
+    }
+  };
+
+  Expected<void> result;
+  for (auto part = parts.begin(); part != parts.end() && result && ret != Z_STREAM_END; ++part) {
+    for (size_t pos = 0; pos < part->size() && result && ret != Z_STREAM_END; pos += CHUNK_CHARS) {
+      auto size = DecodeBase32To(part->substr(pos, CHUNK_CHARS), chunk);
+      if (!size) {
+        result = Error::InvalidBase32;
+        break;
+      }
+      stream.next_in = chunk;
+      stream.avail_in = *size;
+      result = run(false);
+    }
+  }
+  if (result && ret != Z_STREAM_END) {
+    result = run(true);  // flush what inflate still holds back
+  }
+
+  size_t total = discarded + (out.size() - stream.avail_out);
+  inflateEnd(&stream);
+  if (!result) {
+    return result.error();
+  }
+  return total;
+}
+
+struct Inflater::State {
+  z_stream stream;
+  bool initialized = false;
+};
+
+Inflater::Inflater() : state_(std::make_unique<State>()) {}
+
+Inflater::~Inflater() {
+  if (state_->initialized) {
+    inflateEnd(&state_->stream);
+  }
+}
+
+Expected<bool> Inflater::feed(std::span<const unsigned char> input, std::vector<unsigned char> &out) noexcept {
+  static constexpr size_t MIN_OUTPUT_SPACE = 1024;
+  if (finished_) {
+    return true;
+  }
+
+  z_stream &stream = state_->stream;
+  if (!state_->initialized) {
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+    stream.next_in = Z_NULL;
+    stream.avail_in = 0;
+    if (inflateInit2(&stream, -10) != Z_OK) {
+      return Error::DecompressionFailed;
+    }
+    state_->initialized = true;
+  }
+
+  stream.next_in = (Bytef *)(input.data());
+  stream.avail_in = input.size();
+
+  size_t used = out.size();
+  while (true) {
+    if (out.size() - used < MIN_OUTPUT_SPACE) {
+      out.resize(std::max(out.size() * 2, used + MIN_OUTPUT_SPACE));
+    }
+    stream.next_out = (Bytef *)(out.data() + used);
+    stream.avail_out = out.size() - used;
+
+    int ret = inflate(&stream, Z_NO_FLUSH);
+    used = out.size() - stream.avail_out;
+    if (ret == Z_STREAM_END) {
+      finished_ = true;
+      break;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      out.resize(used);
+      return Error::DecompressionFailed;
+    }
+    if (stream.avail_in == 0 && stream.avail_out != 0) {
+      break;  // everything available has been inflated
+    }
+  }
+
+  out.resize(used);
+  return finished_;
+}
+
+template Expected<void> ZlibDecompressor::uncompress(std::span<const unsigned char> source, std::string &out) noexcept;
+template Expected<void> ZlibDecompressor::uncompress(std::span<const unsigned char> source, std::vector<unsigned char> &out) noexcept;
+template Expected<void> ZlibDecompressor::uncompress_base32(std::span<const std::string_view> parts, std::string &out) noexcept;
+template Expected<void> ZlibDecompressor::uncompress_base32(std::span<const std::string_view> parts, std::vector<unsigned char> &out) noexcept;
+template Expected<void> uncompress_base32(CompressionBackend &backend, std::span<const std::string_view> parts, std::string &out) noexcept;
+template Expected<void> uncompress_base32(CompressionBackend &backend, std::span<const std::string_view> parts, std::vector<unsigned char> &out) noexcept;
+
+}  // namespace bbqr
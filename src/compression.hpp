@@ -0,0 +1,147 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bbqr/backend.hpp"
+#include "bbqr/error.hpp"
+
+namespace bbqr {
+// deflateInit2 settings other than the window, which BBQr fixes. The
+// defaults are zlib's.
+struct DeflateParams {
+  enum Strategy { DEFAULT = 0, FILTERED = 1, RLE = 3 };  // zlib's Z_* values
+
+  int level = -1;  // Z_DEFAULT_COMPRESSION
+  int mem_level = 8;
+  Strategy strategy = DEFAULT;
+};
+
+// Raw deflate stream (wbits=-10, as required by the BBQr spec) that is
+// initialized once and reset between payloads.
+// out is resized to the compressed size; its capacity is kept and reused as
+// the initial output space of the next call.
+class ZlibCompressor {
+ public:
+  explicit ZlibCompressor(DeflateParams params = {});
+  ~ZlibCompressor();
+  ZlibCompressor(const ZlibCompressor &) = delete;
+  ZlibCompressor &operator=(const ZlibCompressor &) = delete;
+
+  Expected<void> compress(std::string_view source, std::string &out) noexcept;
+  // Same, but gives up and returns false as soon as the output would grow
+  // past max_size.
+  Expected<bool> compress(std::string_view source, std::string &out, size_t max_size) noexcept;
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+// Deflates raw into out for Encoding::Z and returns whether Z pays off, i.e.
+// the output is smaller than max_ratio * raw.size(). Deflate stops as soon as
+// that is out of reach, and is skipped entirely when a sample of raw looks
+// like random data. With force, raw is always deflated in full.
+Expected<bool> deflate_for_z(ZlibCompressor &compressor, std::string_view raw, std::string &out, bool force,
+                             double max_ratio = 1.0) noexcept;
+// Same with any backend, which always deflates raw in full
+Expected<bool> deflate_for_z(CompressionBackend &backend, std::string_view raw, std::string &out, bool force,
+                             double max_ratio = 1.0) noexcept;
+// The deflated size deflate_for_z() would settle on, or nullopt if it would
+// keep Base32, estimated from deflate_fast() on samples spread over raw
+// instead of deflating all of it.
+std::optional<size_t> estimate_z_size(std::string_view raw, bool force, double max_ratio = 1.0) noexcept;
+
+// The backend split and join use: backend if it is set, else the fast
+// built-in one if fast is set, else the one chosen at configure time, or
+// nullptr if that is zlib, which the library drives itself (reused streams,
+// capped and streamed buffers).
+CompressionBackend *resolve_backend(CompressionBackend *backend, bool fast = false) noexcept;
+
+// Single-shot raw inflate for payloads that are in memory as a whole,
+// without zlib's streaming state machine. Returns false for any malformed
+// input without saying why; ZlibDecompressor then falls back to zlib.
+template <typename Buffer>
+bool fast_inflate(std::span<const unsigned char> source, Buffer &out) noexcept;
+// Same for the Base32 text of the concatenated Z payloads
+template <typename Buffer>
+bool fast_inflate_base32(std::span<const std::string_view> parts, Buffer &out) noexcept;
+
+// Raw deflate (wbits=-10) with an optimal parse: matches and literals are
+// chosen as the shortest path under a bit-cost model that is re-estimated
+// from the previous parse, iterations times, and the input is split into
+// blocks with their own Huffman codes where that pays off. Far slower than
+// zlib; meant for payloads where every byte saved can save a QR frame.
+void deflate_optimal(std::string_view source, std::string &out, int iterations) noexcept;
+// Largest output of deflate_optimal() for size bytes
+size_t deflate_optimal_bound(size_t size) noexcept;
+// Raw deflate (wbits=-10) for throughput: hash chains small enough to stay in
+// L1, a bounded chain walk and one step of lazy matching, with blocks coded
+// like deflate_optimal(). About twice as fast as zlib's default level, with
+// output within about 1% of it. Fits deflate_optimal_bound() too.
+void deflate_fast(std::string_view source, std::string &out) noexcept;
+
+// Raw inflate counterpart of ZlibCompressor, for whole payloads. Unless
+// try_fast_inflate is false, it tries fast_inflate first; zlib decodes what
+// that rejects, and reports the error.
+class ZlibDecompressor {
+ public:
+  explicit ZlibDecompressor(bool try_fast_inflate = true);
+  ~ZlibDecompressor();
+  ZlibDecompressor(const ZlibDecompressor &) = delete;
+  ZlibDecompressor &operator=(const ZlibDecompressor &) = delete;
+
+  template <typename Buffer>
+  Expected<void> uncompress(std::span<const unsigned char> source, Buffer &out) noexcept;
+
+  // Same as uncompress, but source is the Base32 text of the concatenated Z
+  // payloads. It is decoded chunk by chunk into a small buffer that feeds
+  // inflate directly, so the compressed data is never held in full.
+  template <typename Buffer>
+  Expected<void> uncompress_base32(std::span<const std::string_view> parts, Buffer &out) noexcept;
+
+ private:
+  Expected<void> reset() noexcept;
+
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+// Base32-decodes the concatenated Z payloads in full and inflates them with
+// backend.
+template <typename Buffer>
+Expected<void> uncompress_base32(CompressionBackend &backend, std::span<const std::string_view> parts, Buffer &out) noexcept;
+
+// Base32-decodes the concatenated Z payloads chunk by chunk straight into
+// inflate, without buffering the compressed data, and writes the output to
+// out. With discard set, out is only used as scratch space and the result is
+// just the inflated size.
+Expected<size_t> inflate_base32(std::span<const std::string_view> parts, std::span<unsigned char> out, bool discard = false) noexcept;
+
+// Streaming raw inflate (wbits=-10): input can be fed in pieces as it becomes
+// available and output is appended as far as the input allows.
+class Inflater {
+ public:
+  Inflater();
+  ~Inflater();
+  Inflater(const Inflater &) = delete;
+  Inflater &operator=(const Inflater &) = delete;
+
+  // Inflate all of input, appending to out. Returns true once the end of the
+  // deflate stream has been reached.
+  Expected<bool> feed(std::span<const unsigned char> input, std::vector<unsigned char> &out) noexcept;
+  bool is_finished() const { return finished_; }
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+  bool finished_ = false;
+};
+}  // namespace bbqr
+
+#endif
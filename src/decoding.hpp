@@ -0,0 +1,67 @@
+#ifndef DECODING_HPP
+#define DECODING_HPP
+
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "bbqr/bbqr.hpp"
+#include "strencoding.hpp"
+
+namespace bbqr {
+inline bool is_valid_encoding(Encoding encoding) noexcept {
+  return encoding == Encoding::H || encoding == Encoding::Base32 || encoding == Encoding::Z;
+}
+
+inline bool is_valid_file_type(FileType file_type) noexcept {
+  switch (file_type) {
+    case FileType::P:
+    case FileType::T:
+    case FileType::J:
+    case FileType::C:
+    case FileType::U:
+    case FileType::B:
+    case FileType::X:
+      return true;
+  }
+  return false;
+}
+
+// Upper bound of the bytes decode_part() writes for one part. For Z this is
+// the compressed size.
+inline size_t max_decoded_size(Encoding encoding, std::string_view part) noexcept {
+  return encoding == Encoding::H ? ParsedHexSize(part) : DecodedBase32Size(part);
+}
+
+// Decode the payload of a single part into out, which must hold
+// max_decoded_size() bytes. Z parts are only Base32 decoded.
+inline Expected<size_t> decode_part(Encoding encoding, std::string_view part, unsigned char *out) noexcept {
+  switch (encoding) {
+    case Encoding::H: {
+      auto size = TryParseHexTo(part, out);
+      if (!size) {
+        return Error::InvalidHex;
+      }
+      return *size;
+    }
+    case Encoding::Base32:
+    case Encoding::Z: {
+      auto size = DecodeBase32To(part, out);
+      if (!size) {
+        return Error::InvalidBase32;
+      }
+      return *size;
+    }
+  }
+  return Error::InvalidEncoding;
+}
+
+// Decodes H or Base32 parts into out like try_decode_into(), but on up to
+// threads threads (0 for one per core), each decoding a run of parts into
+// its own slice of out. out must hold decoded_size_upper_bound() bytes.
+// Defined in utils.cpp.
+Expected<size_t> decode_parts_parallel(const std::vector<std::string_view> &parts, Encoding encoding,
+                                       std::span<unsigned char> out, unsigned threads) noexcept;
+}  // namespace bbqr
+
+#endif
@@ -0,0 +1,871 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "compression.hpp"
+#include "simd.hpp"
+
+// Deflate with an optimal parse, in the spirit of Zopfli. Every match the 1 KB
+// window allows is found once up front. The parser then picks the cheapest
+// sequence of literals and matches as a shortest path, where the cost of a
+// symbol is its length in bits under a model that is re-estimated from the
+// previous parse. The input is split into blocks first wherever separate
+// Huffman codes make the output smaller, and each block is parsed and coded
+// on its own as stored, fixed or dynamic, whichever is smallest.
+//
+// deflate_fast() shares the block coding but parses greedily with one step of
+// lazy evaluation, like zlib's middle levels.
+
+namespace bbqr {
+namespace {
+constexpr size_t WINDOW_SIZE = 1 << 10;  // wbits=-10
+constexpr int MIN_MATCH = 3;
+constexpr int MAX_MATCH = 258;
+constexpr int END_OF_BLOCK = 256;
+constexpr int LL_CODES = 288;  // 286 and 287 are never used
+constexpr int D_CODES = 30;
+constexpr int CL_CODES = 19;
+constexpr size_t MAX_STORED = 65535;
+constexpr size_t MAX_BLOCKS = 15;
+constexpr size_t MIN_BLOCK_SYMBOLS = 32;
+
+constexpr std::array<uint16_t, 29> LENGTH_BASE = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                                  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::array<uint8_t, 29> LENGTH_EXTRA = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                  2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::array<uint16_t, 30> DIST_BASE = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                                193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                                6145, 8193, 12289, 16385, 24577};
+constexpr std::array<uint8_t, 30> DIST_EXTRA = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                                6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr std::array<uint8_t, CL_CODES> CL_ORDER = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Code of every match length and every distance within the window
+struct CodeTables {
+  std::array<uint8_t, MAX_MATCH + 1> length{};
+  std::array<uint8_t, WINDOW_SIZE + 1> dist{};
+
+  constexpr CodeTables() {
+    for (int code = 0; code < int(LENGTH_BASE.size()); ++code) {
+      int end = code + 1 < int(LENGTH_BASE.size()) ? LENGTH_BASE[code + 1] : MAX_MATCH + 1;
+      for (int len = LENGTH_BASE[code]; len < end; ++len) {
+        length[len] = code;
+      }
+    }
+    for (int code = 0; code < D_CODES && DIST_BASE[code] <= WINDOW_SIZE; ++code) {
+      int end = std::min<int>(DIST_BASE[code + 1], WINDOW_SIZE + 1);
+      for (int d = DIST_BASE[code]; d < end; ++d) {
+        dist[d] = code;
+      }
+    }
+  }
+};
+constexpr CodeTables CODES;
+
+// A literal (dist 0) or a match
+struct Symbol {
+  uint16_t litlen;  // literal byte or match length
+  uint16_t dist;
+
+  size_t size() const { return dist ? litlen : 1; }
+};
+
+// Code lengths of the literal/length and distance alphabets
+struct Lengths {
+  std::array<uint8_t, LL_CODES> ll{};
+  std::array<uint8_t, D_CODES> d{};
+};
+
+Lengths fixed_lengths() {
+  Lengths lengths;
+  std::fill(lengths.ll.begin(), lengths.ll.begin() + 144, 8);
+  std::fill(lengths.ll.begin() + 144, lengths.ll.begin() + 256, 9);
+  std::fill(lengths.ll.begin() + 256, lengths.ll.begin() + 280, 7);
+  std::fill(lengths.ll.begin() + 280, lengths.ll.end(), 8);
+  lengths.d.fill(5);
+  return lengths;
+}
+const Lengths FIXED_LENGTHS = fixed_lengths();
+
+struct Histogram {
+  std::array<uint32_t, LL_CODES> ll{};
+  std::array<uint32_t, D_CODES> d{};
+
+  explicit Histogram(std::span<const Symbol> symbols) {
+    ll[END_OF_BLOCK] = 1;
+    for (Symbol s : symbols) {
+      if (s.dist) {
+        ++ll[257 + CODES.length[s.litlen]];
+        ++d[CODES.dist[s.dist]];
+      } else {
+        ++ll[s.litlen];
+      }
+    }
+  }
+};
+
+// Huffman code lengths for counts, at most max_bits long. Until the tree fits,
+// the counts are halved, which flattens it. Inner nodes are made in order of
+// weight, so two queues stand in for a priority queue: the sorted leaves and
+// the inner nodes as they are made. Ties go to the leaf, then the older node.
+template <size_t N>
+std::array<uint8_t, N> huffman_lengths(const std::array<uint32_t, N>& counts, int max_bits) {
+  std::array<uint8_t, N> lengths{};
+  std::array<uint64_t, N> weights;
+  std::copy(counts.begin(), counts.end(), weights.begin());
+
+  while (true) {
+    // Counting sort by weight, which keeps equal weights in symbol order.
+    // Weights from N up share the last bucket, which is sorted afterwards.
+    std::array<uint16_t, N + 2> bucket{};
+    for (size_t i = 0; i < N; ++i) {
+      if (weights[i] > 0) {
+        ++bucket[std::min<uint64_t>(weights[i], N) + 1];
+      }
+    }
+    std::partial_sum(bucket.begin(), bucket.end(), bucket.begin());
+    size_t last_bucket = bucket[N];
+    size_t leaf_count = bucket[N + 1];
+    std::array<uint16_t, N> leaves;
+    for (size_t i = 0; i < N; ++i) {
+      if (weights[i] > 0) {
+        leaves[bucket[std::min<uint64_t>(weights[i], N)]++] = i;
+      }
+    }
+    std::sort(leaves.begin() + last_bucket, leaves.begin() + leaf_count,
+              [&](int a, int b) { return std::pair(weights[a], a) < std::pair(weights[b], b); });
+    if (leaf_count < 2) {
+      if (leaf_count == 1) {
+        lengths[leaves[0]] = 1;
+      }
+      return lengths;
+    }
+
+    // the sorted leaves are nodes 0..leaf_count-1, inner nodes follow and
+    // always come after their children
+    std::array<uint64_t, 2 * N> weight;
+    std::array<uint16_t, 2 * N> parent;
+    for (size_t i = 0; i < leaf_count; ++i) {
+      weight[i] = weights[leaves[i]];
+    }
+    size_t next_leaf = 0, next_inner = leaf_count, end = leaf_count;
+    const auto take = [&] {
+      if (next_leaf < leaf_count && (next_inner == end || weight[next_leaf] <= weight[next_inner])) {
+        return next_leaf++;
+      }
+      return next_inner++;
+    };
+    for (size_t i = 1; i < leaf_count; ++i) {
+      size_t a = take();
+      size_t b = take();
+      parent[a] = parent[b] = end;
+      weight[end++] = weight[a] + weight[b];
+    }
+    std::array<uint16_t, 2 * N> depth;
+    depth[end - 1] = 0;
+    int max_depth = 0;
+    for (size_t id = end - 1; id-- > 0;) {
+      depth[id] = depth[parent[id]] + 1;
+      if (id < leaf_count) {
+        lengths[leaves[id]] = depth[id];
+        max_depth = std::max<int>(max_depth, depth[id]);
+      }
+    }
+    if (max_depth <= max_bits) {
+      return lengths;
+    }
+    lengths.fill(0);
+    for (auto& w : weights) {
+      w = (w + 1) / 2;
+    }
+  }
+}
+
+// Canonical codes for lengths, bit reversed since deflate sends them MSB first
+template <size_t N>
+std::array<uint16_t, N> canonical_codes(const std::array<uint8_t, N>& lengths) {
+  std::array<uint16_t, 16> count{};
+  for (uint8_t len : lengths) {
+    ++count[len];
+  }
+  count[0] = 0;
+  std::array<uint16_t, 16> next{};
+  for (int bits = 1, code = 0; bits < 16; ++bits) {
+    code = (code + count[bits - 1]) << 1;
+    next[bits] = code;
+  }
+
+  std::array<uint16_t, N> codes{};
+  for (size_t i = 0; i < N; ++i) {
+    if (int len = lengths[i]; len > 0) {
+      uint32_t code = next[len]++;
+      code = ((code & 0x5555) << 1) | ((code >> 1) & 0x5555);
+      code = ((code & 0x3333) << 2) | ((code >> 2) & 0x3333);
+      code = ((code & 0x0F0F) << 4) | ((code >> 4) & 0x0F0F);
+      code = ((code & 0x00FF) << 8) | ((code >> 8) & 0x00FF);
+      codes[i] = code >> (16 - len);
+    }
+  }
+  return codes;
+}
+
+// Stores straight into out, which is sized up front to a bound of the output
+// (and grown should that not hold) and trimmed by finish()
+class BitWriter {
+ public:
+  BitWriter(std::string& out, size_t bound) : out_(out) { out_.resize(bound); }
+
+  // bits must fit in count, which is at most 32
+  void write(uint32_t bits, int count) {
+    buffer_ |= uint64_t(bits) << count_;
+    count_ += count;
+    if (count_ >= 32) {
+      char* p = reserve(4);
+      p[0] = char(buffer_);
+      p[1] = char(buffer_ >> 8);
+      p[2] = char(buffer_ >> 16);
+      p[3] = char(buffer_ >> 24);
+      pos_ += 4;
+      buffer_ >>= 32;
+      count_ -= 32;
+    }
+  }
+
+  // Pads with zeros to a byte boundary and flushes the buffer
+  void align() {
+    char* p = reserve(8);
+    for (count_ = (count_ + 7) & ~7; count_ > 0; count_ -= 8) {
+      *p++ = char(buffer_);
+      buffer_ >>= 8;
+      ++pos_;
+    }
+  }
+
+  // only when aligned
+  void write_bytes(std::string_view bytes) {
+    std::memcpy(reserve(bytes.size()), bytes.data(), bytes.size());
+    pos_ += bytes.size();
+  }
+
+  void finish() {
+    align();
+    out_.resize(pos_);
+  }
+
+ private:
+  char* reserve(size_t n) {
+    if (out_.size() - pos_ < n) {
+      out_.resize(std::max(out_.size() * 2, pos_ + n));
+    }
+    return out_.data() + pos_;
+  }
+
+  std::string& out_;
+  size_t pos_ = 0;
+  uint64_t buffer_ = 0;
+  int count_ = 0;
+};
+
+// Code lengths as sent in a dynamic block header: both alphabets trimmed and
+// run-length encoded with 16 (repeat the previous length 3-6 times), 17 (3-10
+// zeros) and 18 (11-138 zeros), plus the Huffman code for that.
+struct DynamicHeader {
+  Lengths lengths;
+  int hlit = 257;
+  int hdist = 1;
+  int hclen = 4;
+  std::vector<std::pair<uint8_t, uint8_t>> runs;  // symbol, extra bits value
+  std::array<uint8_t, CL_CODES> cl_lengths{};
+
+  static constexpr int extra_bits(int symbol) { return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0; }
+
+  explicit DynamicHeader(const Histogram& histogram) {
+    lengths.ll = huffman_lengths(histogram.ll, 15);
+    lengths.d = huffman_lengths(histogram.d, 15);
+    // Some inflaters reject a distance code with fewer than two symbols
+    int used = std::count_if(lengths.d.begin(), lengths.d.end(), [](uint8_t len) { return len > 0; });
+    if (used < 2) {
+      lengths.d[lengths.d[0] ? 1 : 0] = 1;
+      if (used == 0) {
+        lengths.d[1] = 1;
+      }
+    }
+
+    hlit = 286;
+    while (hlit > 257 && lengths.ll[hlit - 1] == 0) {
+      --hlit;
+    }
+    hdist = D_CODES;
+    while (hdist > 1 && lengths.d[hdist - 1] == 0) {
+      --hdist;
+    }
+
+    std::vector<uint8_t> all(lengths.ll.begin(), lengths.ll.begin() + hlit);
+    all.insert(all.end(), lengths.d.begin(), lengths.d.begin() + hdist);
+    for (size_t i = 0; i < all.size();) {
+      uint8_t len = all[i];
+      size_t run = 1;
+      while (i + run < all.size() && all[i + run] == len) {
+        ++run;
+      }
+      i += run;
+      if (len == 0) {
+        for (; run >= 11; run -= std::min<size_t>(run, 138)) {
+          runs.emplace_back(18, std::min<size_t>(run, 138) - 11);
+        }
+        if (run >= 3) {
+          runs.emplace_back(17, run - 3);
+          run = 0;
+        }
+      } else {
+        runs.emplace_back(len, 0);
+        for (--run; run >= 3; run -= std::min<size_t>(run, 6)) {
+          runs.emplace_back(16, std::min<size_t>(run, 6) - 3);
+        }
+      }
+      for (; run > 0; --run) {
+        runs.emplace_back(len, 0);
+      }
+    }
+
+    std::array<uint32_t, CL_CODES> counts{};
+    for (auto [symbol, extra] : runs) {
+      ++counts[symbol];
+    }
+    cl_lengths = huffman_lengths(counts, 7);
+    hclen = CL_CODES;
+    while (hclen > 4 && cl_lengths[CL_ORDER[hclen - 1]] == 0) {
+      --hclen;
+    }
+  }
+
+  size_t bits() const {
+    size_t bits = 5 + 5 + 4 + 3 * hclen;
+    for (auto [symbol, extra] : runs) {
+      bits += cl_lengths[symbol] + extra_bits(symbol);
+    }
+    return bits;
+  }
+
+  void write(BitWriter& writer) const {
+    writer.write(hlit - 257, 5);
+    writer.write(hdist - 1, 5);
+    writer.write(hclen - 4, 4);
+    for (int i = 0; i < hclen; ++i) {
+      writer.write(cl_lengths[CL_ORDER[i]], 3);
+    }
+    auto codes = canonical_codes(cl_lengths);
+    for (auto [symbol, extra] : runs) {
+      writer.write(codes[symbol], cl_lengths[symbol]);
+      writer.write(extra, extra_bits(symbol));
+    }
+  }
+};
+
+// Bits of every literal/length and distance code under some lengths, extra
+// bits included, so that a block's size is a dot product with its histogram
+struct CodeCosts {
+  std::array<uint8_t, LL_CODES> ll{};
+  std::array<uint8_t, D_CODES> d{};
+
+  explicit CodeCosts(const Lengths& lengths) {
+    for (int c = 0; c < LL_CODES; ++c) {
+      ll[c] = lengths.ll[c] + (c > END_OF_BLOCK && c - 257 < int(LENGTH_EXTRA.size()) ? LENGTH_EXTRA[c - 257] : 0);
+    }
+    for (int c = 0; c < D_CODES; ++c) {
+      d[c] = lengths.d[c] + DIST_EXTRA[c];
+    }
+  }
+};
+const CodeCosts FIXED_COSTS{FIXED_LENGTHS};
+
+size_t data_bits(const Histogram& histogram, const CodeCosts& costs) {
+  size_t bits = 0;
+  for (int c = 0; c < LL_CODES; ++c) {
+    bits += size_t(histogram.ll[c]) * costs.ll[c];
+  }
+  for (int c = 0; c < D_CODES; ++c) {
+    bits += size_t(histogram.d[c]) * costs.d[c];
+  }
+  return bits;
+}
+
+size_t stored_bits(size_t size) {
+  size_t blocks = std::max<size_t>(1, (size + MAX_STORED - 1) / MAX_STORED);
+  return blocks * (3 + 7 + 32) + 8 * size;  // worst case alignment
+}
+
+// Size of symbols as a fixed or dynamic block, whichever is smaller
+size_t huffman_block_bits(std::span<const Symbol> symbols) {
+  Histogram histogram(symbols);
+  DynamicHeader header(histogram);
+  return 3 + std::min(header.bits() + data_bits(histogram, CodeCosts(header.lengths)), data_bits(histogram, FIXED_COSTS));
+}
+
+// For every position, the shortest distance of every match length there, as
+// runs of lengths that share one: (last length of the run, distance), with
+// increasing lengths.
+class MatchFinder {
+ public:
+  struct Run {
+    uint16_t length;
+    uint16_t dist;
+  };
+
+  explicit MatchFinder(std::string_view data) {
+    static constexpr int HASH_BITS = 15;
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    size_t n = data.size();
+
+    std::vector<int32_t> head(size_t(1) << HASH_BITS, -1);
+    std::vector<int32_t> prev(n, -1);
+    offsets_.resize(n + 1);
+    for (size_t i = 0; i < n; ++i) {
+      offsets_[i] = runs_.size();
+      if (i + MIN_MATCH > n) {
+        continue;
+      }
+      uint32_t hash = ((bytes[i] << 10) ^ (bytes[i + 1] << 5) ^ bytes[i + 2]) & ((1 << HASH_BITS) - 1);
+      size_t max_len = std::min<size_t>(MAX_MATCH, n - i);
+      size_t best = MIN_MATCH - 1;
+      // nearer candidates come first, so a match is only kept if it is longer
+      for (int32_t j = head[hash]; j >= 0 && i - j <= WINDOW_SIZE; j = prev[j]) {
+        if (bytes[j + best] != bytes[i + best]) {
+          continue;
+        }
+        size_t len = 0;
+        while (len < max_len && bytes[j + len] == bytes[i + len]) {
+          ++len;
+        }
+        if (len > best) {
+          runs_.push_back({uint16_t(len), uint16_t(i - j)});
+          best = len;
+          if (best == max_len) {
+            break;
+          }
+        }
+      }
+      prev[i] = head[hash];
+      head[hash] = i;
+    }
+    offsets_[n] = runs_.size();
+  }
+
+  std::span<const Run> runs(size_t pos) const {
+    return std::span(runs_).subspan(offsets_[pos], offsets_[pos + 1] - offsets_[pos]);
+  }
+
+ private:
+  std::vector<uint32_t> offsets_;
+  std::vector<Run> runs_;
+};
+
+// Bits the parser charges for a literal, a match length and a distance
+struct CostModel {
+  std::array<double, 256> literal;
+  std::array<double, MAX_MATCH + 1> length;
+  std::array<double, WINDOW_SIZE + 1> dist;
+
+  CostModel(const std::array<double, LL_CODES>& ll, const std::array<double, D_CODES>& d) {
+    std::copy(ll.begin(), ll.begin() + 256, literal.begin());
+    for (int len = MIN_MATCH; len <= MAX_MATCH; ++len) {
+      int lc = CODES.length[len];
+      length[len] = ll[257 + lc] + LENGTH_EXTRA[lc];
+    }
+    for (size_t i = 1; i <= WINDOW_SIZE; ++i) {
+      int dc = CODES.dist[i];
+      dist[i] = d[dc] + DIST_EXTRA[dc];
+    }
+  }
+
+  static CostModel fixed() {
+    std::array<double, LL_CODES> ll;
+    std::array<double, D_CODES> d;
+    std::copy(FIXED_LENGTHS.ll.begin(), FIXED_LENGTHS.ll.end(), ll.begin());
+    std::copy(FIXED_LENGTHS.d.begin(), FIXED_LENGTHS.d.end(), d.begin());
+    return CostModel(ll, d);
+  }
+
+  // Entropy of the symbols of a previous parse; unseen symbols cost as much
+  // as one seen once
+  static CostModel entropy(const Histogram& histogram) {
+    const auto bits = []<size_t N>(const std::array<uint32_t, N>& counts) {
+      double total = std::max<double>(1, std::accumulate(counts.begin(), counts.end(), 0.0));
+      std::array<double, N> bits;
+      for (size_t i = 0; i < N; ++i) {
+        bits[i] = std::log2(total / std::max<uint32_t>(counts[i], 1));
+      }
+      return bits;
+    };
+    return CostModel(bits(histogram.ll), bits(histogram.d));
+  }
+};
+
+// The cheapest symbols for data[begin, end) under model, found as a shortest
+// path over the positions
+std::vector<Symbol> parse(std::string_view data, size_t begin, size_t end, const MatchFinder& finder,
+                          const CostModel& model) {
+  size_t n = end - begin;
+  std::vector<double> cost(n + 1, std::numeric_limits<double>::infinity());
+  std::vector<Symbol> step(n + 1);  // last symbol of the cheapest path to each position
+  cost[0] = 0;
+  uint16_t prev_long_dist = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double base = cost[i];
+    auto c = static_cast<unsigned char>(data[begin + i]);
+    if (base + model.literal[c] < cost[i + 1]) {
+      cost[i + 1] = base + model.literal[c];
+      step[i + 1] = {c, 0};
+    }
+
+    size_t max_len = std::min<size_t>(MAX_MATCH, n - i);
+    auto runs = finder.runs(begin + i);
+    // Inside a long repetition only the longest match is worth trying, as
+    // Zopfli does too; this keeps long runs linear.
+    uint16_t long_dist = !runs.empty() && runs.back().length == MAX_MATCH && max_len == MAX_MATCH ? runs.back().dist : 0;
+    if (long_dist && long_dist == prev_long_dist) {
+      if (double total = base + model.dist[long_dist] + model.length[MAX_MATCH]; total < cost[i + MAX_MATCH]) {
+        cost[i + MAX_MATCH] = total;
+        step[i + MAX_MATCH] = {MAX_MATCH, long_dist};
+      }
+      continue;
+    }
+    prev_long_dist = long_dist;
+
+    size_t len = MIN_MATCH;
+    for (auto run : runs) {
+      double dist_cost = base + model.dist[run.dist];
+      for (size_t last = std::min<size_t>(run.length, max_len); len <= last; ++len) {
+        if (double total = dist_cost + model.length[len]; total < cost[i + len]) {
+          cost[i + len] = total;
+          step[i + len] = {uint16_t(len), run.dist};
+        }
+      }
+      if (len > max_len) {
+        break;
+      }
+    }
+  }
+
+  std::vector<Symbol> symbols;
+  for (size_t i = n; i > 0; i -= step[i].size()) {
+    symbols.push_back(step[i]);
+  }
+  std::reverse(symbols.begin(), symbols.end());
+  return symbols;
+}
+
+// Parses data[begin, end) again and again, each time with the costs measured
+// on the previous parse, and keeps the smallest
+std::vector<Symbol> optimal_parse(std::string_view data, size_t begin, size_t end, const MatchFinder& finder,
+                                  int iterations) {
+  auto symbols = parse(data, begin, end, finder, CostModel::fixed());
+  auto best = symbols;
+  size_t best_bits = huffman_block_bits(best);
+  for (int i = 0; i < iterations; ++i) {
+    symbols = parse(data, begin, end, finder, CostModel::entropy(Histogram(symbols)));
+    if (size_t bits = huffman_block_bits(symbols); bits < best_bits) {
+      best_bits = bits;
+      best = symbols;
+    }
+  }
+  return best;
+}
+
+// Point in (begin, end) that minimises the cost of the two halves: the best
+// of 9 evenly spread points is narrowed down to its neighbours until the
+// remaining points can be tried one by one.
+std::pair<size_t, size_t> find_split(std::span<const Symbol> symbols, size_t begin, size_t end) {
+  const auto cost = [&](size_t k) {
+    return huffman_block_bits(symbols.subspan(begin, k - begin)) + huffman_block_bits(symbols.subspan(k, end - k));
+  };
+
+  size_t lo = begin + MIN_BLOCK_SYMBOLS;
+  size_t hi = end - MIN_BLOCK_SYMBOLS;
+  while (hi - lo > 16) {
+    size_t best = 0;
+    size_t best_cost = std::numeric_limits<size_t>::max();
+    std::array<size_t, 9> points;
+    for (size_t j = 0; j < points.size(); ++j) {
+      points[j] = lo + (hi - lo) * j / (points.size() - 1);
+      if (size_t c = cost(points[j]); c < best_cost) {
+        best_cost = c;
+        best = j;
+      }
+    }
+    lo = points[best > 0 ? best - 1 : 0];
+    hi = points[std::min(best + 1, points.size() - 1)];
+  }
+
+  std::pair<size_t, size_t> best{lo, std::numeric_limits<size_t>::max()};
+  for (size_t k = lo; k <= hi; ++k) {
+    if (size_t c = cost(k); c < best.second) {
+      best = {k, c};
+    }
+  }
+  return best;
+}
+
+// Adds the symbol indices in (begin, end) where starting a new block pays off
+void split_blocks(std::span<const Symbol> symbols, size_t begin, size_t end, std::vector<size_t>& splits) {
+  if (end - begin < 2 * MIN_BLOCK_SYMBOLS || splits.size() + 1 >= MAX_BLOCKS) {
+    return;
+  }
+  auto [k, cost] = find_split(symbols, begin, end);
+  if (cost >= huffman_block_bits(symbols.subspan(begin, end - begin))) {
+    return;
+  }
+  splits.push_back(k);
+  split_blocks(symbols, begin, k, splits);
+  split_blocks(symbols, k, end, splits);
+}
+
+void write_symbols(BitWriter& writer, std::span<const Symbol> symbols, const Lengths& lengths) {
+  auto ll = canonical_codes(lengths.ll);
+  auto d = canonical_codes(lengths.d);
+  for (Symbol s : symbols) {
+    if (s.dist) {
+      int lc = CODES.length[s.litlen];
+      int dc = CODES.dist[s.dist];
+      // each code goes out together with its extra bits
+      writer.write(ll[257 + lc] | (s.litlen - LENGTH_BASE[lc]) << lengths.ll[257 + lc],
+                   lengths.ll[257 + lc] + LENGTH_EXTRA[lc]);
+      writer.write(d[dc] | (s.dist - DIST_BASE[dc]) << lengths.d[dc], lengths.d[dc] + DIST_EXTRA[dc]);
+    } else {
+      writer.write(ll[s.litlen], lengths.ll[s.litlen]);
+    }
+  }
+  writer.write(ll[END_OF_BLOCK], lengths.ll[END_OF_BLOCK]);
+}
+
+// Writes the block for raw, coded as symbols or stored, whichever is smaller
+void write_block(BitWriter& writer, std::span<const Symbol> symbols, std::string_view raw, bool last) {
+  Histogram histogram(symbols);
+  DynamicHeader header(histogram);
+  size_t dynamic = header.bits() + data_bits(histogram, CodeCosts(header.lengths));
+  size_t fixed = data_bits(histogram, FIXED_COSTS);
+
+  if (stored_bits(raw.size()) < 3 + std::min(dynamic, fixed)) {
+    do {
+      auto chunk = raw.substr(0, MAX_STORED);
+      raw.remove_prefix(chunk.size());
+      writer.write(last && raw.empty(), 1);
+      writer.write(0, 2);
+      writer.align();
+      writer.write(chunk.size(), 16);
+      writer.write(~chunk.size() & 0xFFFF, 16);
+      writer.write_bytes(chunk);
+    } while (!raw.empty());
+  } else if (fixed <= dynamic) {
+    writer.write(last, 1);
+    writer.write(1, 2);
+    write_symbols(writer, symbols, FIXED_LENGTHS);
+  } else {
+    writer.write(last, 1);
+    writer.write(2, 2);
+    header.write(writer);
+    write_symbols(writer, symbols, header.lengths);
+  }
+}
+
+// Length of the common prefix of a and b, up to max_len
+inline size_t match_length(const unsigned char* a, const unsigned char* b, size_t max_len) {
+  size_t len = 0;
+#if BBQR_SIMD_X86 && defined(__SSE2__)
+  for (; len + 16 <= max_len; len += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + len));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + len));
+    if (unsigned diff = ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFF) {
+      return len + std::countr_zero(diff);
+    }
+  }
+#endif
+  for (; len + 8 <= max_len; len += 8) {
+    uint64_t x, y;
+    std::memcpy(&x, a + len, 8);
+    std::memcpy(&y, b + len, 8);
+    if (uint64_t diff = x ^ y) {
+      return len + (std::endian::native == std::endian::little ? std::countr_zero(diff) : std::countl_zero(diff)) / 8;
+    }
+  }
+  while (len < max_len && a[len] == b[len]) {
+    ++len;
+  }
+  return len;
+}
+
+// Hash chains over the last WINDOW_SIZE positions only. Heads and chain links
+// take 20 KB together, so the whole matcher stays in L1. Positions are
+// visited in order, each one either searched or skipped, and inserted into
+// the chains as it is passed.
+class FastMatcher {
+ public:
+  static constexpr int HASH_BITS = 12;
+  static constexpr int MAX_CHAIN = 8;        // candidates tried per position
+  static constexpr size_t GOOD_MATCH = 32;   // a match this long only tries a quarter of them
+  static constexpr size_t NICE_MATCH = 128;  // a match this long ends the search
+
+  explicit FastMatcher(std::string_view data)
+      : bytes_(reinterpret_cast<const unsigned char*>(data.data())), size_(data.size()) {
+    head_.fill(-1);
+  }
+
+  // Longest match at the next position that is longer than shorter, or one
+  // of length 0
+  Symbol search(size_t shorter) {
+    size_t pos = next_++;
+    if (pos + MIN_MATCH > size_) {
+      return {0, 0};
+    }
+    uint32_t h = hash(pos);
+    int32_t j = head_[h];
+    prev_[pos & (WINDOW_SIZE - 1)] = j;
+    head_[h] = int32_t(pos);
+
+    size_t max_len = std::min<size_t>(MAX_MATCH, size_ - pos);
+    size_t best = std::max<size_t>(shorter, MIN_MATCH - 1);
+    Symbol match{0, 0};
+    const unsigned char* current = bytes_ + pos;
+    for (int chain = shorter >= GOOD_MATCH ? MAX_CHAIN / 4 : MAX_CHAIN;
+         j >= 0 && pos - j <= WINDOW_SIZE && chain > 0 && best < max_len; --chain) {
+      const unsigned char* candidate = bytes_ + j;
+      if (candidate[best] == current[best]) {
+        if (size_t len = match_length(candidate, current, max_len); len > best) {
+          best = len;
+          match = {uint16_t(len), uint16_t(pos - j)};
+          if (len >= NICE_MATCH) {
+            break;
+          }
+        }
+      }
+      // a link older than j has been overwritten by a newer position
+      int32_t next = prev_[j & (WINDOW_SIZE - 1)];
+      if (next >= j) {
+        break;
+      }
+      j = next;
+    }
+    return match;
+  }
+
+  // Inserts the positions before end without searching them
+  void skip(size_t end) {
+    for (size_t last = std::min(end, size_ - std::min(size_, size_t(MIN_MATCH - 1))); next_ < last; ++next_) {
+      uint32_t h = hash(next_);
+      prev_[next_ & (WINDOW_SIZE - 1)] = head_[h];
+      head_[h] = int32_t(next_);
+    }
+    next_ = std::max(next_, end);
+  }
+
+ private:
+  uint32_t hash(size_t pos) const {
+    uint32_t v = bytes_[pos] | (bytes_[pos + 1] << 8) | (bytes_[pos + 2] << 16);
+    return (v * 0x9E3779B1u) >> (32 - HASH_BITS);
+  }
+
+  const unsigned char* bytes_;
+  size_t size_;
+  size_t next_ = 0;
+  std::array<int32_t, size_t(1) << HASH_BITS> head_;
+  std::array<int32_t, WINDOW_SIZE> prev_{};
+};
+
+// Greedy parse that defers a match by one byte when the next position has a
+// longer one. Matches of LAZY_MATCH bytes and more are taken right away.
+std::vector<Symbol> fast_parse(std::string_view data) {
+  static constexpr size_t LAZY_MATCH = 16;
+  FastMatcher matcher(data);
+  std::vector<Symbol> symbols;
+  symbols.reserve(data.size() / 2 + 16);
+  const auto literal = [&](size_t pos) { symbols.push_back({static_cast<unsigned char>(data[pos]), 0}); };
+
+  Symbol match = matcher.search(0);
+  for (size_t i = 0; i < data.size();) {
+    if (match.litlen == 0) {
+      literal(i++);
+      match = matcher.search(0);
+      continue;
+    }
+    if (match.litlen < LAZY_MATCH) {
+      if (Symbol next = matcher.search(match.litlen); next.litlen > 0) {
+        literal(i++);
+        match = next;
+        continue;
+      }
+    }
+    symbols.push_back(match);
+    i += match.litlen;
+    matcher.skip(i);
+    match = matcher.search(0);
+  }
+  return symbols;
+}
+}  // namespace
+
+void deflate_optimal(std::string_view source, std::string &out, int iterations) noexcept {
+  MatchFinder finder(source);
+
+  // Blocks are chosen on a single parse with fixed costs, then every block is
+  // parsed with its own statistics.
+  auto initial = parse(source, 0, source.size(), finder, CostModel::fixed());
+  std::vector<size_t> splits;
+  split_blocks(initial, 0, initial.size(), splits);
+  std::sort(splits.begin(), splits.end());
+
+  std::vector<size_t> bounds = {0};
+  size_t pos = 0;
+  for (size_t i = 0, next = 0; i < initial.size(); ++i) {
+    if (next < splits.size() && splits[next] == i) {
+      bounds.push_back(pos);
+      ++next;
+    }
+    pos += initial[i].size();
+  }
+  bounds.push_back(source.size());
+
+  BitWriter writer(out, deflate_optimal_bound(source.size()));
+  for (size_t b = 0; b + 1 < bounds.size(); ++b) {
+    auto symbols = optimal_parse(source, bounds[b], bounds[b + 1], finder, iterations);
+    write_block(writer, symbols, source.substr(bounds[b], bounds[b + 1] - bounds[b]), b + 2 == bounds.size());
+  }
+  writer.finish();
+}
+
+size_t deflate_optimal_bound(size_t size) noexcept {
+  // no block is larger than stored, at most 6 bytes per 64 KB chunk, and
+  // each block can add one partial chunk
+  return size + 6 * ((size + MAX_STORED - 1) / MAX_STORED + MAX_BLOCKS);
+}
+
+void deflate_fast(std::string_view source, std::string &out) noexcept {
+  auto symbols = fast_parse(source);
+
+  // blocks of at most MAX_STORED input bytes, so that a stored block is a
+  // single chunk and the output fits deflate_optimal_bound()
+  BitWriter writer(out, deflate_optimal_bound(source.size()));
+  size_t pos = 0;
+  std::span<const Symbol> rest(symbols);
+  while (true) {
+    size_t count = 0, end = pos;
+    while (count < rest.size() && end - pos + rest[count].size() <= MAX_STORED) {
+      end += rest[count++].size();
+    }
+    bool last = count == rest.size();
+    write_block(writer, rest.first(count), source.substr(pos, end - pos), last);
+    if (last) {
+      break;
+    }
+    rest = rest.subspan(count);
+    pos = end;
+  }
+  writer.finish();
+}
+}  // namespace bbqr
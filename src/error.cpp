@@ -0,0 +1,58 @@
+#include "bbqr/error.hpp"
+
+#include <stdexcept>
+
+namespace bbqr {
+const char *error_message(Error error) noexcept {
+  switch (error) {
+    case Error::InvalidHeader:
+      return "Invalid header data";
+    case Error::ConflictingHeader:
+      return "conflicting/variable filetype/encodings/sizes";
+    case Error::PartOutOfRange:
+      return "got part out of range of the part count";
+    case Error::DuplicateMismatch:
+      return "Duplicate part has wrong content";
+    case Error::InconsistentPartLength:
+      return "All parts must be equal length, except for the last one";
+    case Error::InvalidEncoding:
+      return "Invalid encoding";
+    case Error::InvalidHex:
+      return "Invalid hex";
+    case Error::InvalidBase32:
+      return "Invalid base32";
+    case Error::CompressionFailed:
+      return "deflate failed";
+    case Error::DecompressionFailed:
+      return "inflate failed";
+    case Error::VersionOutOfRange:
+      return "min/max version out of range";
+    case Error::SplitOutOfRange:
+      return "min/max split out of range";
+    case Error::CannotFit:
+      return "Cannot make it fit";
+    case Error::InvalidFileType:
+      return "Invalid file type";
+    case Error::BufferTooSmall:
+      return "Output buffer too small";
+    case Error::MissingParts:
+      return "Missing parts";
+  }
+  return "Unknown error";
+}
+
+#if BBQR_EXCEPTIONS
+void throw_error(Error error) {
+  switch (error) {
+    case Error::VersionOutOfRange:
+    case Error::SplitOutOfRange:
+      throw std::out_of_range(error_message(error));
+    case Error::CompressionFailed:
+    case Error::DecompressionFailed:
+      throw std::runtime_error(error_message(error));
+    default:
+      throw std::invalid_argument(error_message(error));
+  }
+}
+#endif
+}  // namespace bbqr
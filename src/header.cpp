@@ -0,0 +1,124 @@
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <initializer_list>
+
+#include "bbqr/bbqr.hpp"
+#include "decoding.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BBQR_HAVE_SSE2 1
+#endif
+
+namespace bbqr {
+static constexpr std::array<int8_t, 256> CreateBase36Map() {
+  std::array<int8_t, 256> map{};
+  for (size_t i = 0; i < map.size(); ++i) {
+    if (i >= '0' && i <= '9') {
+      map[i] = i - '0';
+    } else if (i >= 'A' && i <= 'Z') {
+      map[i] = i - 'A' + 10;
+    } else if (i >= 'a' && i <= 'z') {
+      map[i] = i - 'a' + 10;
+    } else {
+      map[i] = -1;
+    }
+  }
+  return map;
+}
+
+static constexpr auto base36_map = CreateBase36Map();
+
+// Returns -1 unless both chars are base36 digits.
+static int base36_value(char high, char low) {
+  int h = base36_map[uint8_t(high)];
+  int l = base36_map[uint8_t(low)];
+  return (h | l) < 0 ? -1 : h * 36 + l;
+}
+
+Expected<PartHeader> parse_header(std::string_view part) noexcept {
+  if (part.size() < HEADER_LEN || part[0] != 'B' || part[1] != '$') {
+    return Error::InvalidHeader;
+  }
+
+  auto encoding = static_cast<Encoding>(part[2]);
+  if (!is_valid_encoding(encoding)) {
+    return Error::InvalidEncoding;
+  }
+  auto file_type = static_cast<FileType>(part[3]);
+  if (!is_valid_file_type(file_type)) {
+    return Error::InvalidFileType;
+  }
+
+  int count = base36_value(part[4], part[5]);
+  int index = base36_value(part[6], part[7]);
+  if (count <= 0 || index < 0) {
+    return Error::InvalidHeader;
+  }
+  if (index >= count) {
+    return Error::PartOutOfRange;
+  }
+  return PartHeader{
+      .encoding = encoding,
+      .file_type = file_type,
+      .count = count,
+      .index = index,
+  };
+}
+
+static bool is_bbqr_frame(std::string_view frame) {
+  return frame.size() > HEADER_LEN && frame[0] == 'B' && frame[1] == '$' &&
+         is_valid_encoding(static_cast<Encoding>(frame[2])) &&
+         is_valid_file_type(static_cast<FileType>(frame[3]));
+}
+
+size_t filter_frames(std::span<const std::string_view> frames, std::span<bool> is_bbqr) noexcept {
+  size_t matches = 0;
+  size_t i = 0;
+
+#if BBQR_HAVE_SSE2
+  // Transpose the first 4 chars of 16 frames into one vector per position and
+  // check all of them with byte compares. Frames that are too short get a
+  // zero prefix, which never matches.
+  const auto any_of = [](__m128i v, std::initializer_list<char> chars) {
+    __m128i r = _mm_setzero_si128();
+    for (char c : chars) {
+      r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+    }
+    return r;
+  };
+
+  for (; i + 16 <= frames.size(); i += 16) {
+    alignas(16) char prefix[4][16];
+    for (size_t j = 0; j < 16; ++j) {
+      std::string_view frame = frames[i + j];
+      bool long_enough = frame.size() > HEADER_LEN;
+      for (size_t k = 0; k < 4; ++k) {
+        prefix[k][j] = long_enough ? frame[k] : '\0';
+      }
+    }
+
+    __m128i fixed = _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(prefix[0])), _mm_set1_epi8('B')),
+        _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(prefix[1])), _mm_set1_epi8('$')));
+    __m128i encoding = any_of(_mm_load_si128(reinterpret_cast<const __m128i *>(prefix[2])),
+                              {'H', '2', 'Z'});
+    __m128i file_type = any_of(_mm_load_si128(reinterpret_cast<const __m128i *>(prefix[3])),
+                               {'P', 'T', 'J', 'C', 'U', 'B', 'X'});
+    int mask = _mm_movemask_epi8(_mm_and_si128(fixed, _mm_and_si128(encoding, file_type)));
+
+    for (size_t j = 0; j < 16; ++j) {
+      is_bbqr[i + j] = (mask >> j) & 1;
+    }
+    matches += std::popcount(static_cast<unsigned>(mask));
+  }
+#endif
+
+  for (; i < frames.size(); ++i) {
+    is_bbqr[i] = is_bbqr_frame(frames[i]);
+    matches += is_bbqr[i];
+  }
+  return matches;
+}
+}  // namespace bbqr
@@ -0,0 +1,217 @@
+#include <cstdint>
+
+#include "simd.hpp"
+#include "strencoding.hpp"
+
+// Encoding splits every byte into its two nibbles, maps them to digits with a
+// 16-entry shuffle table and interleaves high and low digits. Decoding range
+// checks the chars, maps them to nibbles and packs each pair with a
+// multiply-add (16 * high + low). The decoders stop at the first vector that
+// holds anything but hex digits; the scalar code takes it from there, so
+// whitespace and errors are handled in one place.
+
+namespace bbqr {
+namespace {
+#if BBQR_SIMD_X86
+#define BBQR_HEX_DIGITS '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+
+__attribute__((target("ssse3"))) size_t EncodeHexSsse3(const unsigned char *in, size_t size, char *out) {
+  const __m128i digits = _mm_setr_epi8(BBQR_HEX_DIGITS);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16, out += 32) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+    __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(x, nibble));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_unpackhi_epi8(high, low));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t EncodeHexAvx2(const unsigned char *in, size_t size, char *out) {
+  const __m256i digits = _mm256_setr_epi8(BBQR_HEX_DIGITS, BBQR_HEX_DIGITS);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32, out += 64) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    __m256i high = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+    __m256i low = _mm256_shuffle_epi8(digits, _mm256_and_si256(x, nibble));
+    // unpacking works per 128-bit lane, so the halves come out crosswise
+    __m256i first = _mm256_unpacklo_epi8(high, low);
+    __m256i second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32), _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  return i;
+}
+
+// GCC 12 warns about _mm512_undefined_epi32() inside its own AVX-512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f,avx512bw"))) size_t EncodeHexAvx512(const unsigned char *in, size_t size, char *out) {
+  const __m512i digits = _mm512_broadcast_i32x4(_mm_setr_epi8(BBQR_HEX_DIGITS));
+  const __m512i nibble = _mm512_set1_epi16(0x0F);
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32, out += 64) {
+    // one byte per 16-bit lane, so its digits can go to the low and high byte
+    __m512i x = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i)));
+    x = _mm512_or_si512(_mm512_srli_epi16(x, 4), _mm512_slli_epi16(_mm512_and_si512(x, nibble), 8));
+    _mm512_storeu_si512(out, _mm512_shuffle_epi8(digits, x));
+  }
+  return i;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#undef BBQR_HEX_DIGITS
+
+// Packs each pair of hex digits (either case) in c into 16 * high + low in
+// a 16-bit lane. Returns false if any char isn't a hex digit.
+__attribute__((target("ssse3"))) bool HexPairs(__m128i c, __m128i &pairs) {
+  __m128i digit = InRange(c, '0', '9');
+  __m128i upper = InRange(c, 'A', 'F');
+  __m128i lower = InRange(c, 'a', 'f');
+  if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(digit, upper), lower)) != 0xFFFF) {
+    return false;
+  }
+  __m128i offset = _mm_or_si128(_mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8('0')),
+                                             _mm_and_si128(upper, _mm_set1_epi8('A' - 10))),
+                                _mm_and_si128(lower, _mm_set1_epi8('a' - 10)));
+  pairs = _mm_maddubs_epi16(_mm_sub_epi8(c, offset), _mm_set1_epi16(0x0110));
+  return true;
+}
+
+__attribute__((target("ssse3"))) size_t ParseHexSsse3(const char *in, size_t size, unsigned char *out) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32, out += 16) {
+    __m128i first, second;
+    if (!HexPairs(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), first) ||
+        !HexPairs(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 16)), second)) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(first, second));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) bool HexPairs(__m256i c, __m256i &pairs) {
+  __m256i digit = InRange(c, '0', '9');
+  __m256i upper = InRange(c, 'A', 'F');
+  __m256i lower = InRange(c, 'a', 'f');
+  if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(digit, upper), lower)) != -1) {
+    return false;
+  }
+  __m256i offset = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8('0')),
+                                                   _mm256_and_si256(upper, _mm256_set1_epi8('A' - 10))),
+                                   _mm256_and_si256(lower, _mm256_set1_epi8('a' - 10)));
+  pairs = _mm256_maddubs_epi16(_mm256_sub_epi8(c, offset), _mm256_set1_epi16(0x0110));
+  return true;
+}
+
+__attribute__((target("avx2"))) size_t ParseHexAvx2(const char *in, size_t size, unsigned char *out) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64, out += 32) {
+    __m256i first, second;
+    if (!HexPairs(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i)), first) ||
+        !HexPairs(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i + 32)), second)) {
+      break;
+    }
+    // packing works per 128-bit lane, so the 64-bit quarters come out crosswise
+    __m256i x = _mm256_packus_epi16(first, second);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute4x64_epi64(x, 0xD8));
+  }
+  return i;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f,avx512bw"))) bool HexPairs(__m512i c, __m512i &pairs) {
+  __mmask64 digit = InRange(c, '0', '9');
+  __mmask64 upper = InRange(c, 'A', 'F');
+  __mmask64 lower = InRange(c, 'a', 'f');
+  if ((digit | upper | lower) != ~__mmask64(0)) {
+    return false;
+  }
+  __m512i x = _mm512_mask_sub_epi8(c, digit, c, _mm512_set1_epi8('0'));
+  x = _mm512_mask_sub_epi8(x, upper, x, _mm512_set1_epi8('A' - 10));
+  x = _mm512_mask_sub_epi8(x, lower, x, _mm512_set1_epi8('a' - 10));
+  pairs = _mm512_maddubs_epi16(x, _mm512_set1_epi16(0x0110));
+  return true;
+}
+
+__attribute__((target("avx512f,avx512bw"))) size_t ParseHexAvx512(const char *in, size_t size, unsigned char *out) {
+  const __m512i lanes = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+
+  size_t i = 0;
+  for (; i + 128 <= size; i += 128, out += 64) {
+    __m512i first, second;
+    if (!HexPairs(_mm512_loadu_si512(in + i), first) || !HexPairs(_mm512_loadu_si512(in + i + 64), second)) {
+      break;
+    }
+    __m512i x = _mm512_packus_epi16(first, second);
+    _mm512_storeu_si512(out, _mm512_permutexvar_epi64(lanes, x));
+  }
+  return i;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+size_t EncodeHexNone(const unsigned char *, size_t, char *) { return 0; }
+size_t ParseHexNone(const char *, size_t, unsigned char *) { return 0; }
+
+using EncodeHexFn = size_t (*)(const unsigned char *, size_t, char *);
+using ParseHexFn = size_t (*)(const char *, size_t, unsigned char *);
+
+EncodeHexFn SelectEncodeHex() {
+  switch (DetectSimdLevel()) {
+#if BBQR_SIMD_X86
+    case SimdLevel::Avx512:
+      return EncodeHexAvx512;
+    case SimdLevel::Avx2:
+      return EncodeHexAvx2;
+    case SimdLevel::Ssse3:
+      return EncodeHexSsse3;
+#endif
+    default:
+      return EncodeHexNone;
+  }
+}
+
+ParseHexFn SelectParseHex() {
+  switch (DetectSimdLevel()) {
+#if BBQR_SIMD_X86
+    case SimdLevel::Avx512:
+      return ParseHexAvx512;
+    case SimdLevel::Avx2:
+      return ParseHexAvx2;
+    case SimdLevel::Ssse3:
+      return ParseHexSsse3;
+#endif
+    default:
+      return ParseHexNone;
+  }
+}
+}  // namespace
+
+size_t HexStrBlocks(std::string_view str, char *out) noexcept {
+  static const EncodeHexFn encode_hex = SelectEncodeHex();
+  return encode_hex(reinterpret_cast<const unsigned char *>(str.data()), str.size(), out);
+}
+
+size_t ParseHexBlocks(std::string_view str, unsigned char *out) noexcept {
+  static const ParseHexFn parse_hex = SelectParseHex();
+  return parse_hex(str.data(), str.size(), out);
+}
+}  // namespace bbqr
@@ -0,0 +1,557 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "compression.hpp"
+#include "strencoding.hpp"
+
+// Inflate for payloads that are in memory as a whole. The output buffer
+// doubles as the window, so there is no streaming state machine: every block
+// is decoded in one loop that refills a 64-bit bit buffer with one unaligned
+// load and then has enough bits for a whole length/distance pair. Huffman
+// codes are decoded with one lookup in an 11-bit table (9 KB with the
+// distance table, so it stays in L1) whose entries can hold two literals at
+// once; the rare longer codes are decoded bit by bit. Matches are copied 8
+// bytes at a time.
+//
+// Any error just returns false. The callers then run zlib on the same input,
+// which decides how the payload is rejected.
+
+namespace bbqr {
+namespace {
+constexpr int LL_TABLE_BITS = 11;
+constexpr int D_TABLE_BITS = 8;
+constexpr int MAX_BITS = 15;
+constexpr size_t MAX_MATCH = 258;
+constexpr size_t COPY_SLACK = 8;  // output space past the end that word copies may scribble on
+constexpr size_t WINDOW_SIZE = 1024;  // wbits=-10: zlib rejects distances past this
+// Pairing literals costs about as much as decoding a few KB saves, so it is
+// skipped for blocks that cannot be longer than this
+constexpr size_t PAIR_MIN_INPUT = 1024;
+
+constexpr std::array<uint16_t, 29> LENGTH_BASE = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                                  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::array<uint8_t, 29> LENGTH_EXTRA = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                  2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::array<uint16_t, 30> DIST_BASE = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                                193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                                6145, 8193, 12289, 16385, 24577};
+constexpr std::array<uint8_t, 30> DIST_EXTRA = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                                6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr std::array<uint8_t, 19> CL_ORDER = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// The whole input as one chunk
+class SpanSource {
+ public:
+  explicit SpanSource(std::span<const unsigned char> data) : data_(data) {}
+
+  std::span<const unsigned char> next() { return std::exchange(data_, {}); }
+
+ private:
+  std::span<const unsigned char> data_;
+};
+
+// Base32 text of the parts, decoded a chunk at a time
+class Base32Source {
+ public:
+  explicit Base32Source(std::span<const std::string_view> parts) : parts_(parts) {}
+
+  std::span<const unsigned char> next() {
+    while (!parts_.empty() && pos_ >= parts_.front().size()) {
+      parts_ = parts_.subspan(1);
+      pos_ = 0;
+    }
+    if (parts_.empty()) {
+      return {};
+    }
+    auto size = DecodeBase32To(parts_.front().substr(pos_, CHUNK_CHARS), chunk_);
+    if (!size) {
+      parts_ = {};
+      return {};  // reads as truncated, zlib reports it properly
+    }
+    pos_ += CHUNK_CHARS;
+    return std::span(chunk_, *size);
+  }
+
+ private:
+  // 8 base32 chars decode to 5 whole bytes, so chunks stay byte aligned
+  static constexpr size_t CHUNK_CHARS = 8 * 512;
+
+  std::span<const std::string_view> parts_;
+  size_t pos_ = 0;
+  unsigned char chunk_[CHUNK_CHARS / 8 * 5];
+};
+
+// LSB-first bits from a Source. Past the end of the input it reads zeros and
+// counts them, so the decoder can tell afterwards whether it used any.
+template <typename Source>
+class BitReader {
+ public:
+  explicit BitReader(Source& source) : source_(&source) {}
+
+  // Makes at least 56 bits available. Returns false if that took the slow
+  // path near the end of a chunk, the only place where zeros are made up.
+  bool refill() {
+    if (end_ - next_ >= 8) {
+      uint64_t word;
+      std::memcpy(&word, next_, 8);
+      if constexpr (std::endian::native == std::endian::big) {
+        word = __builtin_bswap64(word);
+      }
+      bits_ |= word << count_;
+      next_ += (63 ^ count_) >> 3;
+      count_ |= 56;
+      return true;
+    }
+    while (count_ < 56) {  // at most 63 bits, so the fast path never shifts by 64
+      if (next_ == end_) {
+        auto chunk = source_->next();
+        next_ = chunk.data();
+        end_ = chunk.data() + chunk.size();
+      }
+      uint64_t byte = 0;
+      if (next_ != end_) {
+        byte = *next_++;
+      } else {
+        ++padding_;
+      }
+      bits_ |= byte << count_;
+      count_ += 8;
+    }
+    return false;
+  }
+
+  uint32_t peek(int n) const { return bits_ & ((uint64_t(1) << n) - 1); }
+  void consume(int n) {
+    bits_ >>= n;
+    count_ -= n;
+  }
+  uint32_t bits(int n) {
+    uint32_t value = peek(n);
+    consume(n);
+    return value;
+  }
+  void align() { consume(count_ & 7); }
+  // Input bytes left in the current chunk
+  size_t buffered() const { return end_ - next_; }
+
+  // True once more zeros were made up than are still unread, i.e. the
+  // decoder went past the end of the input.
+  bool overrun() const { return padding_ * 8 > size_t(count_); }
+
+ private:
+  Source* source_;
+  const unsigned char* next_ = nullptr;
+  const unsigned char* end_ = nullptr;
+  uint64_t bits_ = 0;
+  int count_ = 0;
+  size_t padding_ = 0;
+};
+
+// The low len bits of code in reverse order (Huffman codes are stored MSB
+// first, everything else LSB first)
+uint32_t reverse_bits(uint32_t code, int len) {
+  code = ((code & 0x5555) << 1) | ((code >> 1) & 0x5555);
+  code = ((code & 0x3333) << 2) | ((code >> 2) & 0x3333);
+  code = ((code & 0x0F0F) << 4) | ((code >> 4) & 0x0F0F);
+  code = ((code & 0x00FF) << 8) | ((code >> 8) & 0x00FF);
+  return code >> (16 - len);
+}
+
+// Canonical Huffman decoder. Table entries hold the bits used in the low
+// byte, the number of symbols in the next byte and the symbols above:
+// 0 symbols means the code is longer than the table (or unused) and has to
+// be decoded bit by bit; 2 symbols are two literals in one entry.
+template <int TABLE_BITS, int SYMBOLS>
+class Huffman {
+ public:
+  static uint32_t entry(int bits, int symbols, uint32_t value) { return bits | (symbols << 8) | (value << 16); }
+  static int entry_bits(uint32_t e) { return e & 0xFF; }
+  static int entry_symbols(uint32_t e) { return (e >> 8) & 0xFF; }
+  static uint32_t entry_value(uint32_t e) { return e >> 16; }
+  // one or two literals, as opposed to a length, end-of-block or long code
+  static bool is_literal(uint32_t e) { return entry_symbols(e) == 2 || (entry_symbols(e) == 1 && e < (256u << 16)); }
+
+  // False for over-subscribed codes, and for incomplete ones other than a
+  // single 1-bit code (the same rule as zlib). No codes at all is accepted,
+  // as long as nothing is decoded with it.
+  bool build(const uint8_t* lengths, int n, bool pair_literals = false) {
+    count_.fill(0);
+    for (int i = 0; i < n; ++i) {
+      ++count_[lengths[i]];
+    }
+    count_[0] = 0;
+    int max = MAX_BITS;
+    while (max > 0 && count_[max] == 0) {
+      --max;
+    }
+
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; ++len) {
+      left = (left << 1) - count_[len];
+      if (left < 0) {
+        return false;
+      }
+    }
+    if (left > 0 && max > 1) {
+      return false;
+    }
+    complete_ = left == 0;
+
+    std::array<uint16_t, MAX_BITS + 2> offsets{};
+    for (int len = 1; len <= MAX_BITS; ++len) {
+      offsets[len + 1] = offsets[len] + count_[len];
+    }
+    for (int symbol = 0; symbol < n; ++symbol) {
+      if (lengths[symbol] != 0) {
+        symbols_[offsets[lengths[symbol]]++] = symbol;
+      }
+    }
+
+    // The codes of one length are consecutive, so the table is filled for
+    // the first len bits and then doubled for the next length, which leaves
+    // one store per code. Entries no code reaches stay zero.
+    std::array<uint16_t, 256> pairable;  // literals that can start a pair, and their codes
+    std::array<uint16_t, 256> pairable_code;
+    int pairable_count = 0;
+    table_[0] = table_[1] = 0;
+    for (int len = 1, index = 0, code = 0; len <= TABLE_BITS; ++len, code <<= 1) {
+      if (len > 1) {
+        std::memcpy(&table_[1 << (len - 1)], &table_[0], sizeof(table_[0]) << (len - 1));
+      }
+      for (int i = 0; i < count_[len]; ++i, ++index, ++code) {
+        int symbol = symbols_[index];
+        uint32_t reversed = reverse_bits(code, len);
+        table_[reversed] = entry(len, 1, symbol);
+        if (pair_literals && symbol < 256 && len < TABLE_BITS) {
+          pairable[pairable_count] = symbol;
+          pairable_code[pairable_count++] = reversed;
+        }
+      }
+    }
+
+    // A pair overrides the entries of its first literal wherever the
+    // following bits hold a whole second one. Both lists are sorted by
+    // length, so the inner loop stops at the first second that is too long.
+    for (int i = 0; i < pairable_count; ++i) {
+      int first_len = lengths[pairable[i]];
+      for (int j = 0; j < pairable_count; ++j) {
+        int len = first_len + lengths[pairable[j]];
+        if (len > TABLE_BITS) {
+          break;
+        }
+        uint32_t value = pairable[i] | (pairable[j] << 8);
+        for (uint32_t k = pairable_code[i] | (pairable_code[j] << first_len); k < table_.size(); k += 1 << len) {
+          table_[k] = entry(len, 2, value);
+        }
+      }
+    }
+    return true;
+  }
+
+  bool complete() const { return complete_; }
+  uint32_t lookup(uint32_t bits) const { return table_[bits & (table_.size() - 1)]; }
+
+  // Bit-by-bit decode, needs MAX_BITS available. Returns -1 for unused codes.
+  template <typename Reader>
+  int decode_slow(Reader& reader) const {
+    uint32_t bits = reader.peek(MAX_BITS);
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len <= MAX_BITS; ++len) {
+      code |= (bits >> (len - 1)) & 1;
+      int count = count_[len];
+      if (code - count < first) {
+        reader.consume(len);
+        return symbols_[index + (code - first)];
+      }
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+
+ private:
+  std::array<uint32_t, 1 << TABLE_BITS> table_;
+  std::array<uint16_t, MAX_BITS + 1> count_;
+  std::array<uint16_t, SYMBOLS> symbols_;
+  bool complete_ = false;
+};
+
+using LiteralCode = Huffman<LL_TABLE_BITS, 288>;
+using DistanceCode = Huffman<D_TABLE_BITS, 32>;  // 30 and 31 only exist in the fixed code
+
+struct FixedCodes {
+  LiteralCode ll;
+  DistanceCode d;
+
+  FixedCodes() {
+    std::array<uint8_t, 288> lengths;
+    std::fill(lengths.begin(), lengths.begin() + 144, 8);
+    std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+    std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+    std::fill(lengths.begin() + 280, lengths.end(), 8);
+    ll.build(lengths.data(), 288, true);
+    lengths.fill(5);
+    d.build(lengths.data(), 32);
+  }
+};
+
+template <typename Source, typename Buffer>
+class Inflate {
+ public:
+  Inflate(Source& source, Buffer& out) : reader_(source), out_(out) {}
+
+  bool run() {
+    out_.resize(std::max(out_.capacity(), size_t(1024)));
+    bool last = false;
+    while (!last) {
+      reader_.refill();
+      last = reader_.bits(1);
+      bool ok = false;
+      switch (reader_.bits(2)) {
+        case 0:
+          ok = stored();
+          break;
+        case 1: {
+          static const FixedCodes fixed;
+          ok = codes(fixed.ll, fixed.d);
+          break;
+        }
+        case 2:
+          ok = dynamic();
+          break;
+      }
+      if (!ok || reader_.overrun()) {
+        return false;
+      }
+    }
+    out_.resize(pos_);
+    return true;
+  }
+
+ private:
+  // Room for n more bytes plus the slack of word copies
+  unsigned char* reserve(size_t n) {
+    if (out_.size() - pos_ < n + COPY_SLACK) {
+      out_.resize(std::max(out_.size() * 2, pos_ + n + COPY_SLACK));
+    }
+    return reinterpret_cast<unsigned char*>(out_.data());
+  }
+
+  bool stored() {
+    reader_.align();
+    reader_.refill();
+    uint32_t len = reader_.bits(16);
+    if ((reader_.bits(16) ^ 0xFFFF) != len) {
+      return false;
+    }
+    unsigned char* out = reserve(len);
+    for (uint32_t i = 0; i < len; ++i) {
+      reader_.refill();
+      out[pos_++] = reader_.bits(8);
+      if (reader_.overrun()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool dynamic() {
+    reader_.refill();
+    int hlit = reader_.bits(5) + 257;
+    int hdist = reader_.bits(5) + 1;
+    int hclen = reader_.bits(4) + 4;
+    if (hlit > 286 || hdist > 30) {
+      return false;
+    }
+
+    std::array<uint8_t, 19> cl_lengths{};
+    reader_.refill();
+    for (int i = 0; i < hclen; ++i) {
+      if (i == 16) {
+        reader_.refill();  // all 19 take 57 bits, one more than a refill guarantees
+      }
+      cl_lengths[CL_ORDER[i]] = reader_.bits(3);
+    }
+    Huffman<7, 19> cl;
+    // unlike the other codes, this one must not be a lone 1-bit code
+    if (!cl.build(cl_lengths.data(), 19) || (!cl.complete() && cl_lengths != decltype(cl_lengths){})) {
+      return false;
+    }
+
+    std::array<uint8_t, 286 + 30> lengths{};
+    for (int i = 0; i < hlit + hdist;) {
+      reader_.refill();
+      uint32_t e = cl.lookup(reader_.peek(7));
+      int symbol;
+      if (Huffman<7, 19>::entry_symbols(e) == 1) {
+        reader_.consume(Huffman<7, 19>::entry_bits(e));
+        symbol = Huffman<7, 19>::entry_value(e);
+      } else if ((symbol = cl.decode_slow(reader_)) < 0) {
+        return false;
+      }
+
+      if (symbol < 16) {
+        lengths[i++] = symbol;
+        continue;
+      }
+      uint8_t len = 0;
+      int repeat;
+      if (symbol == 16) {
+        if (i == 0) {
+          return false;
+        }
+        len = lengths[i - 1];
+        repeat = 3 + reader_.bits(2);
+      } else if (symbol == 17) {
+        repeat = 3 + reader_.bits(3);
+      } else {
+        repeat = 11 + reader_.bits(7);
+      }
+      if (i + repeat > hlit + hdist) {
+        return false;
+      }
+      std::fill_n(lengths.begin() + i, repeat, len);
+      i += repeat;
+    }
+    if (lengths[256] == 0) {
+      return false;  // no end-of-block code
+    }
+
+    bool pair_literals = reader_.buffered() >= PAIR_MIN_INPUT;
+    if (!ll_.build(lengths.data(), hlit, pair_literals) || !d_.build(lengths.data() + hlit, hdist)) {
+      return false;
+    }
+    return codes(ll_, d_);
+  }
+
+  bool codes(const LiteralCode& ll, const DistanceCode& d) {
+    // The loop works on local copies: the output is written through a char
+    // pointer, which could alias the members and would make the compiler
+    // reload them after every byte.
+    BitReader<Source> reader = reader_;
+    size_t pos = pos_;
+    auto done = [&](bool ok) {
+      reader_ = reader;
+      pos_ = pos;
+      return ok;
+    };
+    unsigned char* base = reserve(0);
+    while (true) {
+      if (!reader.refill() && reader.overrun()) {
+        return done(false);
+      }
+      // room for a whole match, or for the literals below
+      if (out_.size() - pos < MAX_MATCH + COPY_SLACK) {
+        pos_ = pos;
+        base = reserve(MAX_MATCH);
+      }
+      unsigned char* out = base + pos;
+
+      // table entries take at most 11 bits, so 56 bits are enough for four
+      // of them. Both bytes are always stored; for a single literal the
+      // second one is overwritten later.
+      uint32_t e = ll.lookup(reader.peek(LL_TABLE_BITS));
+      for (int i = 0; i < 4 && LiteralCode::is_literal(e); ++i) {
+        out[0] = LiteralCode::entry_value(e);
+        out[1] = LiteralCode::entry_value(e) >> 8;
+        out += LiteralCode::entry_symbols(e);
+        reader.consume(LiteralCode::entry_bits(e));
+        e = ll.lookup(reader.peek(LL_TABLE_BITS));
+      }
+      pos = out - base;
+      if (LiteralCode::is_literal(e)) {
+        continue;
+      }
+
+      // 56 bits: a 15-bit length code, 5 extra bits, a 15-bit distance code
+      // and 13 extra bits
+      reader.refill();
+      int symbol;
+      if (LiteralCode::entry_symbols(e) == 1) {
+        symbol = LiteralCode::entry_value(e);
+        reader.consume(LiteralCode::entry_bits(e));
+      } else if ((symbol = ll.decode_slow(reader)) < 0) {
+        return done(false);
+      }
+
+      if (symbol < 256) {
+        *out = symbol;
+        ++pos;
+        continue;
+      } else if (symbol == 256) {
+        return done(true);
+      } else if (symbol > 285) {
+        return done(false);
+      }
+      size_t len = LENGTH_BASE[symbol - 257] + reader.bits(LENGTH_EXTRA[symbol - 257]);
+
+      e = d.lookup(reader.peek(D_TABLE_BITS));
+      if (DistanceCode::entry_symbols(e) == 1) {
+        symbol = DistanceCode::entry_value(e);
+        reader.consume(DistanceCode::entry_bits(e));
+      } else if ((symbol = d.decode_slow(reader)) < 0) {
+        return done(false);
+      }
+      if (symbol > 29) {
+        return done(false);
+      }
+      size_t dist = DIST_BASE[symbol] + reader.bits(DIST_EXTRA[symbol]);
+      if (dist > pos || dist > WINDOW_SIZE) {
+        return done(false);
+      }
+      copy_match(out, dist, len);
+      pos += len;
+    }
+  }
+
+  static void copy_match(unsigned char* dst, size_t dist, size_t len) {
+    const unsigned char* src = dst - dist;
+    if (dist >= 8) {
+      // each word is read before it is written, so overlaps are fine
+      for (size_t i = 0; i < len; i += 8) {
+        std::memcpy(dst + i, src + i, 8);
+      }
+    } else if (dist == 1) {
+      std::memset(dst, *src, len);
+    } else {
+      for (size_t i = 0; i < len; ++i) {
+        dst[i] = src[i];
+      }
+    }
+  }
+
+  BitReader<Source> reader_;
+  Buffer& out_;
+  size_t pos_ = 0;
+  LiteralCode ll_;
+  DistanceCode d_;
+};
+}  // namespace
+
+template <typename Buffer>
+bool fast_inflate(std::span<const unsigned char> source, Buffer& out) noexcept {
+  SpanSource input(source);
+  return Inflate(input, out).run();
+}
+
+template <typename Buffer>
+bool fast_inflate_base32(std::span<const std::string_view> parts, Buffer& out) noexcept {
+  Base32Source input(parts);
+  return Inflate(input, out).run();
+}
+
+template bool fast_inflate(std::span<const unsigned char> source, std::string& out) noexcept;
+template bool fast_inflate(std::span<const unsigned char> source, std::vector<unsigned char>& out) noexcept;
+template bool fast_inflate_base32(std::span<const std::string_view> parts, std::string& out) noexcept;
+template bool fast_inflate_base32(std::span<const std::string_view> parts, std::vector<unsigned char>& out) noexcept;
+}  // namespace bbqr
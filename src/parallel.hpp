@@ -0,0 +1,49 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "bbqr/error.hpp"
+
+namespace bbqr {
+// Payload chars each thread should get at least, so that starting it costs
+// little next to the work it takes over
+inline constexpr size_t MIN_CHARS_PER_THREAD = 256 * 1024;
+
+// Number of threads to share count parts of chars payload chars between, for
+// a requested threads (0 for one per core).
+inline size_t worker_count(unsigned threads, size_t count, size_t chars) noexcept {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  return std::clamp<size_t>(chars / MIN_CHARS_PER_THREAD, 1, std::max<size_t>(std::min<size_t>(threads, count), 1));
+}
+
+// Calls run(worker, begin, end) for workers contiguous runs covering
+// [0, count), the first on the calling thread and the others on their own.
+// A run whose thread cannot be started is done by the calling thread.
+template <typename Run>
+void for_each_run(size_t count, size_t workers, Run&& run) noexcept {
+  auto run_worker = [&](size_t worker) { run(worker, count * worker / workers, count * (worker + 1) / workers); };
+  std::vector<std::jthread> pool;
+  pool.reserve(workers - 1);
+  for (size_t worker = 1; worker < workers; ++worker) {
+#if BBQR_EXCEPTIONS
+    try {
+      pool.emplace_back(run_worker, worker);
+    } catch (const std::system_error&) {
+      run_worker(worker);
+    }
+#else
+    pool.emplace_back(run_worker, worker);
+#endif
+  }
+  run_worker(0);
+}
+}  // namespace bbqr
+
+#endif
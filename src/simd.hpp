@@ -0,0 +1,55 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BBQR_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define BBQR_SIMD_X86 0
+#endif
+
+namespace bbqr {
+// Widest vector extension the block kernels in base32.cpp and hex.cpp may use
+// on this CPU. The kernels are compiled with per-function target attributes,
+// so only GCC and Clang on x86 get anything but None.
+enum class SimdLevel { None, Ssse3, Avx2, Avx512 };
+
+inline SimdLevel DetectSimdLevel() noexcept {
+#if BBQR_SIMD_X86
+  static const SimdLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+      return SimdLevel::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdLevel::Avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+      return SimdLevel::Ssse3;
+    }
+    return SimdLevel::None;
+  }();
+  return level;
+#else
+  return SimdLevel::None;
+#endif
+}
+
+#if BBQR_SIMD_X86
+// Mask of the chars in [low, high]. Chars >= 0x80 compare as negative and
+// never match.
+inline __m128i InRange(__m128i c, char low, char high) {
+  return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(low - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(high + 1)));
+}
+
+__attribute__((target("avx2"))) inline __m256i InRange(__m256i c, char low, char high) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(low - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), c));
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline __mmask64 InRange(__m512i c, char low, char high) {
+  return _mm512_cmpgt_epi8_mask(c, _mm512_set1_epi8(low - 1)) & _mm512_cmplt_epi8_mask(c, _mm512_set1_epi8(high + 1));
+}
+#endif
+}  // namespace bbqr
+
+#endif
@@ -9,6 +9,7 @@
 #include <iterator>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace bbqr {
@@ -58,13 +59,34 @@ bool ConvertBits(O outfn, It it, It end, I infn = {}) {
   return true;
 }
 
-inline std::string EncodeBase32(std::string_view input, bool pad = false) {
+/** Number of chars EncodeBase32To() writes for size bytes (without padding). */
+constexpr size_t EncodedBase32Size(size_t size) {
+  return (size * 8 + 4) / 5;
+}
+
+/**
+ * Encode the whole 5-byte blocks at the start of input to 8 chars each, with
+ * the fastest implementation the CPU supports (AVX-512BW, AVX2, SSSE3, or
+ * 64-bit SWAR). Returns the number of bytes consumed. Defined in base32.cpp.
+ */
+size_t EncodeBase32Blocks(std::string_view input, char* out) noexcept;
+
+/** Encode base32 without padding into out, which must hold EncodedBase32Size(input.size()) chars. */
+inline void EncodeBase32To(std::string_view input, char* out) {
   static const char* pbase32 = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
 
+  size_t done = EncodeBase32Blocks(input, out);
+  out += done / 5 * 8;
+  input.remove_prefix(done);
+  ConvertBits<8, 5, true>([&](int v) { *out++ = pbase32[v]; }, input.begin(),
+                          input.end(), [](char c) -> unsigned char { return c; });
+}
+
+inline std::string EncodeBase32(std::string_view input, bool pad = false) {
   std::string str;
   str.reserve(((input.size() + 4) / 5) * 8);
-  ConvertBits<8, 5, true>([&](int v) { str += pbase32[v]; }, input.begin(),
-                          input.end(), [](char c) -> unsigned char { return c; });
+  str.resize(EncodedBase32Size(input.size()));
+  EncodeBase32To(input, str.data());
   if (pad) {
     while (str.size() % 8) {
       str += '=';
@@ -73,7 +95,21 @@ inline std::string EncodeBase32(std::string_view input, bool pad = false) {
   return str;
 }
 
-inline std::optional<std::vector<unsigned char>> DecodeBase32(std::string_view str) {
+/** Maximum number of bytes DecodeBase32To() can write for the given input. */
+constexpr size_t DecodedBase32Size(std::string_view str) {
+  return str.size() * 5 / 8;
+}
+
+/**
+ * Decode the whole 8-char blocks at the start of str to 5 bytes each, with
+ * the fastest implementation the CPU supports, checking the alphabet on the
+ * way. Returns the number of chars consumed, or nullopt for an invalid char.
+ * out must hold DecodedBase32Size(str) bytes. Defined in base32.cpp.
+ */
+std::optional<size_t> DecodeBase32Blocks(std::string_view str, unsigned char* out) noexcept;
+
+/** Decode base32 into out, which must hold DecodedBase32Size(str) bytes. Returns the number of bytes written. */
+inline std::optional<size_t> DecodeBase32To(std::string_view str, unsigned char* out) {
   static constexpr int8_t decode32_table[256]{
       -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
       -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -104,30 +140,56 @@ inline std::optional<std::vector<unsigned char>> DecodeBase32(std::string_view s
   while (!str.empty() && str.back() == '=') {
     str.remove_suffix(1);
   }
-  std::vector<unsigned char> ret;
-  ret.reserve((str.size() * 5) / 8);
+  auto blocks = DecodeBase32Blocks(str, out);
+  if (!blocks)
+    return {};
+  str.remove_prefix(*blocks);
+
+  unsigned char* it = out + *blocks / 8 * 5;
   bool valid = ConvertBits<5, 8, false>(
-      [&](unsigned char c) { ret.push_back(c); },
+      [&](unsigned char c) { *it++ = c; },
       str.begin(), str.end(),
       [](char c) { return decode32_table[uint8_t(c)]; });
   if (!valid)
     return {};
 
+  return it - out;
+}
+
+inline std::optional<std::vector<unsigned char>> DecodeBase32(std::string_view str) {
+  std::vector<unsigned char> ret(DecodedBase32Size(str));
+  auto size = DecodeBase32To(str, ret.data());
+  if (!size)
+    return {};
+
+  ret.resize(*size);
   return ret;
 }
 
-inline std::string HexStr(const std::string_view str) {
-  std::string rv(str.size() * 2, '\0');
+/**
+ * Write the hex digits of a prefix of str to out with the fastest SIMD
+ * implementation the CPU supports. Returns the number of bytes encoded,
+ * possibly 0. Defined in hex.cpp.
+ */
+size_t HexStrBlocks(std::string_view str, char* out) noexcept;
+
+/** Write the hex digits of str to out, which must hold 2 * str.size() chars. */
+inline void HexStrTo(std::string_view str, char* out) {
   static constexpr auto byte_to_hex = CreateByteToHexMap();
   static_assert(sizeof(byte_to_hex) == 512);
 
-  char* it = rv.data();
+  size_t done = HexStrBlocks(str, out);
+  str.remove_prefix(done);
+  out += 2 * done;
   for (uint8_t v : str) {
-    std::memcpy(it, byte_to_hex[v].data(), 2);
-    it += 2;
+    std::memcpy(out, byte_to_hex[v].data(), 2);
+    out += 2;
   }
+}
 
-  assert(it == rv.data() + rv.size());
+inline std::string HexStr(const std::string_view str) {
+  std::string rv(str.size() * 2, '\0');
+  HexStrTo(str, rv.data());
   return rv;
 }
 
@@ -156,11 +218,27 @@ constexpr inline bool IsSpace(char c) noexcept {
   return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
 }
 
+/** Maximum number of bytes TryParseHexTo() can write for the given input. */
+constexpr size_t ParsedHexSize(std::string_view str) {
+  return str.size() / 2;
+}
+
+/**
+ * Parse a prefix of str made of hex digits only (no whitespace) into out with
+ * the fastest SIMD implementation the CPU supports. Stops early at anything
+ * else. Returns the number of chars consumed, always even. Defined in hex.cpp.
+ */
+size_t ParseHexBlocks(std::string_view str, unsigned char* out) noexcept;
+
+/** Parse hex into out, which must hold ParsedHexSize(str) bytes. Returns the number of bytes written. */
 template <typename Byte = uint8_t>
-inline std::optional<std::vector<Byte>> TryParseHex(const std::string_view str) {
-  std::vector<Byte> vch;
-  auto it = str.begin();
-  vch.reserve(str.size() / 2);
+inline std::optional<size_t> TryParseHexTo(const std::string_view str, Byte* out) {
+  static_assert(sizeof(Byte) == 1);
+
+  // whitespace and invalid chars are left to the loop below
+  size_t done = ParseHexBlocks(str, reinterpret_cast<unsigned char*>(out));
+  Byte* vch = out + done / 2;
+  auto it = str.begin() + done;
   while (it != str.end()) {
     if (IsSpace(*it)) {
       ++it;
@@ -172,8 +250,19 @@ inline std::optional<std::vector<Byte>> TryParseHex(const std::string_view str)
     auto c2 = HexDigit(*(it++));
     if (c1 < 0 || c2 < 0)
       return std::nullopt;
-    vch.push_back(Byte(c1 << 4) | Byte(c2));
+    *vch++ = Byte(c1 << 4) | Byte(c2);
   }
+  return vch - out;
+}
+
+template <typename Byte = uint8_t>
+inline std::optional<std::vector<Byte>> TryParseHex(const std::string_view str) {
+  std::vector<Byte> vch(ParsedHexSize(str));
+  auto size = TryParseHexTo(str, vch.data());
+  if (!size)
+    return std::nullopt;
+
+  vch.resize(*size);
   return vch;
 }
 
@@ -1,156 +1,209 @@
 #include "bbqr/utils.hpp"
 
+#include <cstring>
+#include <optional>
+
+#include "compression.hpp"
+#include "decoding.hpp"
+#include "parallel.hpp"
 #include "strencoding.hpp"
-#include "zlib.h"
 
 namespace bbqr {
-static std::string zlib_compress(std::string_view source) {
-  std::string buff(source.size(), '\0');
-
-  z_stream stream;
-  stream.zalloc = (alloc_func)0;
-  stream.zfree = (free_func)0;
-  stream.opaque = (voidpf)0;
-  stream.next_out = (Bytef *)(buff.data());
-  stream.avail_out = buff.size();
-  stream.next_in = (Bytef *)(source.data());
-  stream.avail_in = source.size();
-
-  int ret = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -10, 8,
-                         Z_DEFAULT_STRATEGY);
-  if (ret != Z_OK)
-    throw std::runtime_error("deflateInit failed: " + std::to_string(ret));
-
-  while (true) {
-    ret = deflate(&stream, Z_FINISH);
-    if (ret == Z_STREAM_END) {
-      break;
-    } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
-      auto size = buff.size();
-      buff.resize(size * 2);
-      stream.next_out = (Bytef *)(buff.data() + stream.total_out);
-      stream.avail_out = buff.size() - size;
-    } else {
-      throw std::runtime_error("deflate failed: " + std::to_string(ret));
+Expected<std::pair<std::string, Encoding>> try_encode_data(std::string_view raw, Encoding encoding, bool force_encoding) noexcept {
+  switch (encoding) {
+    case Encoding::H:
+      return std::make_pair(HexStr(raw), encoding);
+    case Encoding::Base32:
+      return std::make_pair(EncodeBase32(raw), encoding);
+    case Encoding::Z: {
+      std::string compressed;
+      ZlibCompressor compressor;
+      CompressionBackend *backend = resolve_backend(nullptr);
+      auto use_z = backend ? deflate_for_z(*backend, raw, compressed, force_encoding)
+                           : deflate_for_z(compressor, raw, compressed, force_encoding);
+      if (!use_z) {
+        return use_z.error();
+      }
+      return *use_z ? std::make_pair(EncodeBase32(compressed), Encoding::Z)
+                    : std::make_pair(EncodeBase32(raw), Encoding::Base32);
     }
   }
+  return Error::InvalidEncoding;
+}
 
-  deflateEnd(&stream);
-  buff.resize(stream.total_out);
-  return buff;
+Expected<std::pair<std::string, Encoding>> try_encode_data(const std::vector<unsigned char> &raw, Encoding encoding, bool force_encoding) noexcept {
+  return try_encode_data(std::string_view(reinterpret_cast<const char *>(raw.data()), raw.size()), encoding, force_encoding);
 }
 
-template <typename RawType>
-static RawType zlib_uncompress(const std::vector<unsigned char> &source) {
-  static constexpr int INITIAL_BUFFER_SIZE = 1024;
-  RawType buff(INITIAL_BUFFER_SIZE, '\0');
-
-  z_stream stream;
-  stream.zalloc = (alloc_func)0;
-  stream.zfree = (free_func)0;
-  stream.opaque = (voidpf)0;
-  stream.next_out = (Bytef *)(buff.data());
-  stream.avail_out = buff.size();
-  stream.next_in = (Bytef *)(source.data());
-  stream.avail_in = source.size();
-
-  int ret = inflateInit2(&stream, -10);
-  if (ret != Z_OK)
-    throw std::runtime_error("inflateInit failed: " + std::to_string(ret));
-
-  while (true) {
-    ret = inflate(&stream, Z_NO_FLUSH);
-    if (ret == Z_STREAM_END) {
-      break;
-    } else if (ret == Z_BUF_ERROR) {
-      auto size = buff.size();
-      buff.resize(size * 2);
-      stream.next_out = (Bytef *)(buff.data() + stream.total_out);
-      stream.avail_out = buff.size() - size;
-    } else if (ret != Z_OK) {
-      throw std::runtime_error("inflate failed: " + std::to_string(ret));
+template <typename RawType, typename Container>
+Expected<RawType> decode_data_c(const Container &parts, Encoding encoding) noexcept {
+  if (!is_valid_encoding(encoding)) {
+    return Error::InvalidEncoding;
+  }
+
+  RawType result;
+  if (encoding == Encoding::Z) {
+    std::vector<std::string_view> views(parts.begin(), parts.end());
+    CompressionBackend *backend = resolve_backend(nullptr);
+    auto inflated = backend ? uncompress_base32(*backend, views, result) : ZlibDecompressor().uncompress_base32(views, result);
+    if (!inflated) {
+      return inflated.error();
     }
-  };
+    return result;
+  }
 
-  inflateEnd(&stream);
-  buff.resize(stream.total_out);
-  return buff;
+  size_t size = 0;
+  for (auto &&part : parts) {
+    size += max_decoded_size(encoding, part);
+  }
+  result.resize(size);
+  auto *out = reinterpret_cast<unsigned char *>(result.data());
+
+  size_t offset = 0;
+  for (auto &&part : parts) {
+    auto decoded = decode_part(encoding, part, out + offset);
+    if (!decoded) {
+      return decoded.error();
+    }
+    offset += *decoded;
+  }
+  result.resize(offset);
+  return result;
 }
 
-std::pair<std::string, Encoding> encode_data(std::string_view raw, Encoding encoding, bool force_encoding) {
-  switch (encoding) {
-    case Encoding::H:
-      return {HexStr(raw), encoding};
-    case Encoding::Base32:
-      return {EncodeBase32(raw), encoding};
-    case Encoding::Z: {
-      auto compressed = zlib_compress(raw);
-      bool use_z = compressed.size() < raw.size() || force_encoding;
-      return use_z ? std::make_pair(EncodeBase32(compressed), Encoding::Z)
-                   : std::make_pair(EncodeBase32(raw), Encoding::Base32);
-    }
+template <typename RawType>
+Expected<RawType> try_decode_data(const std::vector<std::string_view> &parts, Encoding encoding) noexcept {
+  return decode_data_c<RawType>(parts, encoding);
+}
+
+template <typename RawType>
+Expected<RawType> try_decode_data(const std::vector<std::string> &parts, Encoding encoding) noexcept {
+  return decode_data_c<RawType>(parts, encoding);
+}
+
+template <typename RawType>
+Expected<RawType> try_decode_data(const std::initializer_list<std::string> &parts, Encoding encoding) noexcept {
+  return decode_data_c<RawType>(parts, encoding);
+}
+
+template Expected<std::string> try_decode_data(const std::vector<std::string_view> &parts, Encoding encoding) noexcept;
+template Expected<std::vector<unsigned char>> try_decode_data(const std::vector<std::string_view> &parts, Encoding encoding) noexcept;
+template Expected<std::string> try_decode_data(const std::vector<std::string> &parts, Encoding encoding) noexcept;
+template Expected<std::vector<unsigned char>> try_decode_data(const std::vector<std::string> &parts, Encoding encoding) noexcept;
+template Expected<std::string> try_decode_data(const std::initializer_list<std::string> &parts, Encoding encoding) noexcept;
+template Expected<std::vector<unsigned char>> try_decode_data(const std::initializer_list<std::string> &parts, Encoding encoding) noexcept;
+
+Expected<size_t> decoded_size_upper_bound(const std::vector<std::string_view> &parts, Encoding encoding) noexcept {
+  if (!is_valid_encoding(encoding)) {
+    return Error::InvalidEncoding;
+  }
+  if (encoding == Encoding::Z) {
+    unsigned char window[4096];
+    return inflate_base32(parts, window, true);
   }
-  throw std::invalid_argument("Invalid encoding");
+
+  size_t size = 0;
+  for (auto &&part : parts) {
+    size += max_decoded_size(encoding, part);
+  }
+  return size;
 }
 
-std::pair<std::string, Encoding> encode_data(const std::vector<unsigned char> &raw, Encoding encoding, bool force_encoding) {
-  return encode_data(std::string_view(reinterpret_cast<const char *>(raw.data()), raw.size()), encoding, force_encoding);
+Expected<size_t> try_decode_into(const std::vector<std::string_view> &parts, Encoding encoding, std::span<std::byte> out) noexcept {
+  if (!is_valid_encoding(encoding)) {
+    return Error::InvalidEncoding;
+  }
+  auto *data = reinterpret_cast<unsigned char *>(out.data());
+  if (encoding == Encoding::Z) {
+    return inflate_base32(parts, std::span(data, out.size()));
+  }
+
+  size_t offset = 0;
+  for (auto &&part : parts) {
+    if (max_decoded_size(encoding, part) > out.size() - offset) {
+      return Error::BufferTooSmall;
+    }
+    auto decoded = decode_part(encoding, part, data + offset);
+    if (!decoded) {
+      return decoded.error();
+    }
+    offset += *decoded;
+  }
+  return offset;
 }
 
-template <typename RawType, typename Container>
-RawType decode_data_c(const Container &parts, Encoding encoding) {
-  switch (encoding) {
-    case Encoding::H: {
-      RawType result;
-      for (auto &&part : parts) {
-        auto v = TryParseHex(part);
-        if (!v) {
-          throw std::invalid_argument("Invalid hex");
-        }
-        result.insert(result.end(), v->begin(), v->end());
+Expected<size_t> decode_parts_parallel(const std::vector<std::string_view> &parts, Encoding encoding,
+                                       std::span<unsigned char> out, unsigned threads) noexcept {
+  if (encoding != Encoding::H && encoding != Encoding::Base32) {
+    return Error::InvalidEncoding;
+  }
+
+  // Every part gets a slice as long as its bound, so the parts are independent
+  std::vector<size_t> offsets(parts.size() + 1);
+  size_t chars = 0;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    offsets[i + 1] = offsets[i] + max_decoded_size(encoding, parts[i]);
+    chars += parts[i].size();
+  }
+  if (offsets.back() > out.size()) {
+    return Error::BufferTooSmall;
+  }
+
+  size_t workers = worker_count(threads, parts.size(), chars);
+  std::vector<size_t> sizes(parts.size());
+  std::vector<std::optional<Error>> errors(workers);
+  for_each_run(parts.size(), workers, [&](size_t worker, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto decoded = decode_part(encoding, parts[i], out.data() + offsets[i]);
+      if (!decoded) {
+        errors[worker] = decoded.error();
+        return;
       }
-      return result;
+      sizes[i] = *decoded;
     }
-    case Encoding::Base32: {
-      RawType result;
-      for (auto &&part : parts) {
-        auto v = DecodeBase32(part);
-        if (!v) {
-          throw std::invalid_argument("Invalid base32");
-        }
-        result.insert(result.end(), v->begin(), v->end());
-      }
-      return result;
+  });
+
+  // the first failing run holds the first bad part, as a sequential decode reports
+  for (auto &&error : errors) {
+    if (error) {
+      return *error;
     }
-    case Encoding::Z: {
-      std::vector<unsigned char> buff;
-      for (auto &&part : parts) {
-        auto v = DecodeBase32(part);
-        if (!v) {
-          throw std::invalid_argument("Invalid base32");
-        }
-        buff.insert(buff.end(), v->begin(), v->end());
-      }
+  }
 
-      return zlib_uncompress<RawType>(buff);
+  // hex with whitespace and the last Base32 part can fall short of their
+  // bound; close the gaps
+  size_t size = 0;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    if (size != offsets[i]) {
+      std::memmove(out.data() + size, out.data() + offsets[i], sizes[i]);
     }
+    size += sizes[i];
   }
-  throw std::invalid_argument("Invalid encoding");
+  return size;
+}
+
+#if BBQR_EXCEPTIONS
+std::pair<std::string, Encoding> encode_data(std::string_view raw, Encoding encoding, bool force_encoding) {
+  return try_encode_data(raw, encoding, force_encoding).value();
+}
+
+std::pair<std::string, Encoding> encode_data(const std::vector<unsigned char> &raw, Encoding encoding, bool force_encoding) {
+  return try_encode_data(raw, encoding, force_encoding).value();
 }
 
 template <typename RawType>
 RawType decode_data(const std::vector<std::string_view> &parts, Encoding encoding) {
-  return decode_data_c<RawType>(parts, encoding);
+  return try_decode_data<RawType>(parts, encoding).value();
 }
 
 template <typename RawType>
 RawType decode_data(const std::vector<std::string> &parts, Encoding encoding) {
-  return decode_data_c<RawType>(parts, encoding);
+  return try_decode_data<RawType>(parts, encoding).value();
 }
 
 template <typename RawType>
 RawType decode_data(const std::initializer_list<std::string> &parts, Encoding encoding) {
-  return decode_data_c<RawType>(parts, encoding);
+  return try_decode_data<RawType>(parts, encoding).value();
 }
 
 template std::string decode_data(const std::vector<std::string_view> &parts, Encoding encoding);
@@ -160,6 +213,10 @@ template std::vector<unsigned char> decode_data(const std::vector<std::string> &
 template std::string decode_data(const std::initializer_list<std::string> &parts, Encoding encoding);
 template std::vector<unsigned char> decode_data(const std::initializer_list<std::string> &parts, Encoding encoding);
 
+size_t decode_into(const std::vector<std::string_view> &parts, Encoding encoding, std::span<std::byte> out) {
+  return try_decode_into(parts, encoding, out).value();
+}
+
 std::string int2base36(int num) {
   if (num < 0 || num > 1295) {
     throw std::out_of_range("Out of range");
@@ -172,5 +229,6 @@ std::string int2base36(int num) {
   std::string ret({tostr(num / 36), tostr(num % 36)});
   return ret;
 }
+#endif
 
 }  // namespace bbqr
@@ -1,4 +1,8 @@
+#include <bbqr/backend.hpp>
 #include <bbqr/bbqr.hpp>
+#include <bbqr/utils.hpp>
+#include <bit>
+#include <random>
 
 #include "doctest.h"
 #include "test_utils.hpp"
@@ -13,3 +17,321 @@ TEST_CASE("test real scan") {
   CHECK(j.raw.find_first_of("Zlib compressed") != std::string::npos);
   CHECK(j.raw.find_first_of("PSBT") != std::string::npos);
 }
+
+TEST_CASE("test try_join_qrs errors") {
+  auto parts = split_qrs(random_bytes(5'000), FileType::B, SplitOption{.max_version = 10}).parts;
+  REQUIRE(parts.size() > 2);
+
+  auto with = [&](size_t i, std::string part) {
+    auto copy = parts;
+    copy[i] = std::move(part);
+    return try_join_qrs(copy);
+  };
+
+  CHECK(try_join_qrs(parts).has_value());
+  CHECK(try_join_qrs({}).error() == Error::InvalidHeader);
+  CHECK(with(0, "B$Z").error() == Error::InvalidHeader);
+  CHECK(with(0, "X" + parts[0].substr(1)).error() == Error::InvalidHeader);
+  CHECK(with(0, "B$ZB00" + parts[0].substr(6)).error() == Error::InvalidHeader);
+  CHECK(with(0, "B$QB" + parts[0].substr(4)).error() == Error::InvalidEncoding);
+  // unknown file types were accepted before parse_header
+  CHECK(with(0, "B$ZQ" + parts[0].substr(4)).error() == Error::InvalidFileType);
+  CHECK(try_join_qrs(std::vector<std::string>{"B$ZQ" + parts[0].substr(4)}, nullptr, 4).error() == Error::InvalidFileType);
+  CHECK(with(1, parts[1].substr(0, 3) + "P" + parts[1].substr(4)).error() == Error::ConflictingHeader);
+  CHECK(with(1, parts[1].substr(0, 6) + "ZZ" + parts[1].substr(8)).error() == Error::PartOutOfRange);
+  CHECK(with(1, parts[1].substr(0, 6) + "!!" + parts[1].substr(8)).error() == Error::InvalidHeader);
+  CHECK(with(1, parts[1].substr(0, parts[1].size() - 8)).error() == Error::InconsistentPartLength);
+  CHECK(with(1, parts[1].substr(0, parts[1].size() - 1) + "1").error() == Error::InvalidBase32);
+
+  auto duplicate = parts;
+  duplicate.push_back(parts[1]);
+  duplicate.back().back() = duplicate.back().back() == 'A' ? 'B' : 'A';
+  CHECK(try_join_qrs(duplicate).error() == Error::DuplicateMismatch);
+
+  CHECK(try_split_qrs("", FileType::B, SplitOption{.min_version = 0}).error() == Error::VersionOutOfRange);
+  CHECK(try_split_qrs("", FileType::B, SplitOption{.min_split = 2, .max_split = 1}).error() == Error::SplitOutOfRange);
+  CHECK(try_split_qrs(std::string(5'000, 'A'), FileType::B, SplitOption{.encoding = Encoding::H, .min_version = 1, .max_version = 1, .max_split = 2}).error() == Error::CannotFit);
+  CHECK_THROWS_AS(join_qrs(std::vector<std::string>{"B$Z"}), std::invalid_argument);
+  CHECK_THROWS_AS(split_qrs("", FileType::B, SplitOption{.min_version = 0}), std::out_of_range);
+}
+
+TEST_CASE("test parse header") {
+  auto header = parse_header("B$ZP0C0B");
+  REQUIRE(header.has_value());
+  CHECK(header->encoding == Encoding::Z);
+  CHECK(header->file_type == FileType::P);
+  CHECK(header->count == 12);
+  CHECK(header->index == 11);
+  CHECK(parse_header("B$HTzz01AB")->count == 1295);
+
+  CHECK(parse_header("B$ZP0C0").error() == Error::InvalidHeader);
+  CHECK(parse_header("B#ZP0C0B").error() == Error::InvalidHeader);
+  CHECK(parse_header("B$QP0C0B").error() == Error::InvalidEncoding);
+  CHECK(parse_header("B$ZQ0C0B").error() == Error::InvalidFileType);
+  CHECK(parse_header("B$ZP000B").error() == Error::InvalidHeader);
+  CHECK(parse_header("B$ZP0C-B").error() == Error::InvalidHeader);
+  CHECK(parse_header("B$ZP0C0C").error() == Error::PartOutOfRange);
+}
+
+TEST_CASE("test filter frames") {
+  std::vector<std::string> samples = {
+      "B$ZP0C0BAAAA", "B$2U0100AB", "B$HX0100A", "B$ZP0C0B", "", "B$", "hello world",
+      "B$QP0C0BAAAA", "B$ZQ0C0BAAAA", "b$ZP0C0BAAAA", "bitcoin:bc1q...", "B$JP0C0BAAAA"};
+  std::vector<bool> expected = {true, true, true, false, false, false, false, false, false, false, false, false};
+
+  // enough frames to go through both the vectorized and the scalar loop
+  std::vector<std::string_view> frames;
+  std::vector<bool> expected_frames;
+  for (size_t i = 0; i < 100; ++i) {
+    frames.push_back(samples[i * 7 % samples.size()]);
+    expected_frames.push_back(expected[i * 7 % samples.size()]);
+  }
+
+  std::unique_ptr<bool[]> is_bbqr(new bool[frames.size()]);
+  size_t matches = filter_frames(frames, std::span(is_bbqr.get(), frames.size()));
+  CHECK(matches == std::count(expected_frames.begin(), expected_frames.end(), true));
+  for (size_t i = 0; i < frames.size(); ++i) {
+    CHECK(is_bbqr[i] == expected_frames[i]);
+  }
+}
+
+TEST_CASE("test join into caller buffer") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<unsigned char> data = read_all_file("./test_data/1in1000out.psbt");
+
+  for (Encoding encoding : encodings) {
+    auto parts = split_qrs(data, FileType::P, SplitOption{.encoding = encoding, .max_version = 20}).parts;
+    REQUIRE(parts.size() > 2);
+
+    auto size = decoded_size_upper_bound(parts);
+    REQUIRE(size.has_value());
+    CHECK(*size >= data.size());
+    if (encoding == Encoding::Z) {
+      CHECK(*size == data.size());
+    }
+
+    std::vector<std::byte> out(*size);
+    auto joined = try_join_into(parts, out);
+    REQUIRE(joined.has_value());
+    CHECK(joined->is_complete == true);
+    CHECK(joined->file_type == FileType::P);
+    CHECK(joined->raw.data() == out.data());
+    CHECK(std::ranges::equal(std::as_bytes(std::span(data)), joined->raw));
+
+    CHECK(try_join_into(parts, std::span(out).first(data.size() - 1)).error() == Error::BufferTooSmall);
+
+    auto incomplete = parts;
+    incomplete.erase(incomplete.begin() + 1);
+    auto partial = join_into(incomplete, out);
+    CHECK(partial.is_complete == false);
+    CHECK(partial.raw.empty());
+    CHECK(partial.processed_parts_count == parts.size() - 1);
+    if (encoding == Encoding::Z) {
+      CHECK(decoded_size_upper_bound(incomplete).error() == Error::MissingParts);
+    } else {
+      CHECK(decoded_size_upper_bound(incomplete).value() >= data.size());
+    }
+  }
+}
+
+TEST_CASE("test join into exactly sized buffer") {
+  // Random sizes put the ends of the 4096-byte window and of the output at
+  // every position relative to the Base32 chunks and parts.
+  std::mt19937 gen(11);
+  for (int round = 0; round < 500; ++round) {
+    std::string raw;
+    size_t size = 1 + gen() % 100'000;
+    while (raw.size() < size) {
+      raw += gen() % 2 ? char('a' + gen() % 3) : char(gen());
+    }
+    int min_version = 1 + gen() % 40;
+    auto split_result = split_qrs(raw, FileType::U, SplitOption{.encoding = Encoding::Z, .force_encoding = true, .min_version = min_version});
+    REQUIRE(split_result.encoding == Encoding::Z);
+
+    auto size_bound = decoded_size_upper_bound(split_result.parts);
+    REQUIRE(size_bound.has_value());
+    CHECK(*size_bound == raw.size());
+
+    std::vector<std::byte> out(raw.size());
+    auto joined = try_join_into(split_result.parts, out);
+    REQUIRE(joined.has_value());
+    CHECK(std::ranges::equal(std::as_bytes(std::span(raw)), joined->raw));
+    CHECK(try_join_into(split_result.parts, std::span(out).first(raw.size() - 1)).error() == Error::BufferTooSmall);
+  }
+}
+
+TEST_CASE("test base32 decoding") {
+  const auto decode = [](std::string str) { return try_decode_data<std::string>({str}, Encoding::Base32); };
+
+  CHECK(decode("MZXW6YTBOI").value() == "foobar");
+  CHECK(decode("MZXW6YTBOI======").value() == "foobar");
+  CHECK(decode("mzxw6ytboi").value() == "foobar");
+  CHECK(decode("MY").value() == "f");
+  CHECK(decode("MZ").error() == Error::InvalidBase32);       // non-zero trailing bits
+  CHECK(decode("MZXW6YT").error() == Error::InvalidBase32);  // leftover char
+
+  // long enough for the block loops of every SIMD width, with tails
+  for (size_t size = 0; size < 300; size += 7) {
+    auto raw = random_bytes(size);
+    auto [encoded, encoding] = encode_data(raw, Encoding::Base32);
+    CHECK(try_decode_data({encoded}, Encoding::Base32).value() == raw);
+
+    for (size_t i = 0; i < encoded.size(); i += 5) {
+      for (char c : {'=', '0', '1', '8', '@', '[', '`', '{', '\x80'}) {
+        std::string bad = encoded;
+        bad[i] = c;
+        if (c == '=' && i == bad.size() - 1) {
+          continue;  // trailing padding
+        }
+        CHECK(decode(bad).error() == Error::InvalidBase32);
+      }
+    }
+  }
+}
+
+TEST_CASE("test hex decoding") {
+  const auto decode = [](std::string str) { return try_decode_data<std::string>({str}, Encoding::H); };
+
+  CHECK(decode("666F6F626172").value() == "foobar");
+  CHECK(decode("666f6f626172").value() == "foobar");
+  CHECK(decode("66 6F 6F 62 61 72").value() == "foobar");
+  CHECK(decode("666F6F62617").error() == Error::InvalidHex);  // odd length
+
+  // long enough for the block loops of every SIMD width, with tails
+  for (size_t size = 0; size < 300; size += 7) {
+    auto raw = random_bytes(size);
+    auto [encoded, encoding] = encode_data(raw, Encoding::H);
+    std::string expected;
+    for (unsigned char byte : raw) {
+      expected += "0123456789ABCDEF"[byte >> 4];
+      expected += "0123456789ABCDEF"[byte & 0x0F];
+    }
+    CHECK(encoded == expected);
+    CHECK(try_decode_data({encoded}, Encoding::H).value() == raw);
+
+    for (size_t i = 0; i < encoded.size(); i += 5) {
+      for (char c : {'/', ':', '@', 'G', '`', 'g', '\x80'}) {
+        std::string bad = encoded;
+        bad[i] = c;
+        CHECK(decode(bad).error() == Error::InvalidHex);
+      }
+    }
+  }
+}
+
+TEST_CASE("test streamed Z decoding") {
+  // compressible, and long enough to span several Base32 chunks
+  std::string raw;
+  for (int i = 0; raw.size() < 100'000; ++i) {
+    raw += std::to_string(i * 7919 % 10007) + ",";
+  }
+  auto [encoded, encoding] = encode_data(raw, Encoding::Z);
+  REQUIRE(encoding == Encoding::Z);
+
+  std::vector<std::string> parts;
+  for (size_t pos = 0; pos < encoded.size(); pos += 808) {
+    parts.push_back(encoded.substr(pos, 808));
+  }
+  CHECK(try_decode_data<std::string>(parts, Encoding::Z).value() == raw);
+  CHECK(try_decode_data<std::string>({encoded}, Encoding::Z).value() == raw);
+
+  parts.pop_back();
+  CHECK(try_decode_data<std::string>(parts, Encoding::Z).error() == Error::DecompressionFailed);
+  parts[0][3] = '1';
+  CHECK(try_decode_data<std::string>(parts, Encoding::Z).error() == Error::InvalidBase32);
+}
+
+TEST_CASE("test Z decoding across Base32 chunks") {
+  // Each payload spans several 4096-char Base32 chunks. Among them are chunk
+  // ends where the in-tree inflater has 64 bits buffered right before a
+  // refill.
+  std::mt19937 gen(3);
+  Codec codec;
+  for (int round = 0; round < 300; ++round) {
+    std::string raw;
+    size_t size = 10'000 + gen() % 30'000;
+    while (raw.size() < size) {
+      raw += gen() % 4 ? char('a' + gen() % 16) : char(gen());
+    }
+    auto split_result = split_qrs(raw, FileType::U, SplitOption{.encoding = Encoding::Z, .min_version = 1, .max_version = 20});
+    REQUIRE(split_result.encoding == Encoding::Z);
+    REQUIRE(split_result.parts.size() > 1);
+
+    std::vector<std::string_view> payloads;
+    for (std::string_view part : split_result.parts) {
+      payloads.push_back(part.substr(8));
+    }
+    CHECK(try_decode_data<std::string>(payloads, Encoding::Z).value() == raw);
+    CHECK(codec.join_qrs<std::string>(split_result.parts).raw == raw);
+  }
+}
+
+TEST_CASE("test Z block types") {
+  auto inflate = [](std::string_view deflated) {
+    auto [encoded, encoding] = encode_data(deflated, Encoding::Base32);
+    REQUIRE(encoding == Encoding::Base32);
+    return try_decode_data<std::string>({encoded}, Encoding::Z);
+  };
+  using namespace std::string_view_literals;
+  CHECK(inflate("\x01\x05\x00\xfa\xffhello"sv).value() == "hello");
+  CHECK(inflate("\x4b\x4c\x4a\x4e\x44\x45\x3a\x0a\x10\x5a\x11\x00"sv).value() == "abcabcabcabcabcabc, abcabc!");
+  // a match before the start of the output
+  CHECK(inflate("\x03\x02\x00"sv).error() == Error::DecompressionFailed);
+  // a stored block whose length check fails
+  CHECK(inflate("\x01\x05\x00\xfa\xfehello"sv).error() == Error::DecompressionFailed);
+
+  // skewed byte counts give codes longer than any lookup table
+  std::mt19937 gen(7);
+  std::string raw;
+  while (raw.size() < 50'000) {
+    raw += char('a' + std::countr_zero(gen() | 1u << 20));
+  }
+  auto [encoded, encoding] = encode_data(raw, Encoding::Z);
+  REQUIRE(encoding == Encoding::Z);
+  CHECK(try_decode_data<std::string>({encoded}, Encoding::Z).value() == raw);
+
+  // a dynamic block sending all 19 code length code lengths, read where the
+  // in-tree inflater has the fewest bits buffered
+  auto builtin = make_compression_backend(BackendType::Builtin);
+  std::string_view all_lengths = "\x3a\x71\xe2\xc4\x89\x13\x80\x02\xf0\x90\x04\x00\x00\x00\x00\x10\xb6\xfa\xff\x84\x02\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x04"sv;
+  std::vector<unsigned char> deflated(all_lengths.begin(), all_lengths.end()), inflated;
+  REQUIRE(builtin->decompress(deflated, inflated));
+  std::vector<unsigned char> expected(5, 0xc8);
+  expected.resize(205, 'a');
+  CHECK(inflated == expected);
+
+  // a stored block of 2048 bytes, then a fixed block with one 3-byte match:
+  // distances past the 1024-byte window of wbits=-10 are rejected
+  auto with_match = [](uint32_t dist_symbol, uint32_t dist_extra, int extra_bits) {
+    std::vector<unsigned char> deflated = {0x00, 0x00, 0x08, 0xff, 0xf7};
+    for (int i = 0; i < 2048; ++i) {
+      deflated.push_back('a' + i % 26);
+    }
+    uint32_t bits = 0;
+    int count = 0;
+    auto put = [&](uint32_t value, int n, bool huffman) {
+      for (int i = 0; i < n; ++i) {
+        bits |= (huffman ? value >> (n - 1 - i) & 1 : value >> i & 1) << count++;
+      }
+    };
+    put(0b011, 3, false);  // final fixed block
+    put(1, 7, true);       // length 3
+    put(dist_symbol, 5, true);
+    put(dist_extra, extra_bits, false);
+    put(0, 7, true);  // end of block
+    for (; count > 0; count -= 8, bits >>= 8) {
+      deflated.push_back(bits & 0xff);
+    }
+    return deflated;
+  };
+  auto near = with_match(19, 1000 - 769, 8), far = with_match(21, 2000 - 1537, 9);
+  REQUIRE(builtin->decompress(near, inflated));
+  CHECK(inflated.size() == 2051);
+  CHECK(std::equal(inflated.begin() + 2048, inflated.end(), inflated.begin() + 1048));
+  CHECK(builtin->decompress(far, inflated).error() == Error::DecompressionFailed);
+  auto part = [](const std::vector<unsigned char> &deflated) {
+    return std::vector<std::string>{"B$ZU0100" + encode_data(std::string(deflated.begin(), deflated.end()), Encoding::Base32).first};
+  };
+  CHECK(try_join_qrs(part(near)).has_value());
+  CHECK(try_join_qrs(part(far)).error() == Error::DecompressionFailed);
+}
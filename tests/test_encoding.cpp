@@ -1,6 +1,8 @@
+#include <bbqr/backend.hpp>
 #include <bbqr/bbqr.hpp>
 #include <bbqr/utils.hpp>
 #include <format>
+#include <ranges>
 
 #include "doctest.h"
 #include "stringification.h"
@@ -34,6 +36,99 @@ TEST_CASE("test compression") {
   }
 }
 
+TEST_CASE("test incompressible data") {
+  for (size_t size : {1, 100, 5'000, 50'000}) {
+    auto raw = random_bytes(size);
+    CHECK(encode_data(raw, Encoding::Z).second == Encoding::Base32);
+    CHECK(split_qrs(raw, FileType::B).encoding == Encoding::Base32);
+
+    auto [encoded, encoding] = encode_data(raw, Encoding::Z, true);
+    CHECK(encoding == Encoding::Z);
+    CHECK(decode_data({encoded}, Encoding::Z) == raw);
+  }
+
+  // compresses to about 77%
+  auto raw = read_all_file("./test_data/signed.txn");
+  CHECK(split_qrs(raw, FileType::T).encoding == Encoding::Z);
+  CHECK(split_qrs(raw, FileType::T, SplitOption{.max_compression_ratio = 0.7}).encoding == Encoding::Base32);
+  CHECK(split_qrs(raw, FileType::T, SplitOption{.max_compression_ratio = 0.8}).encoding == Encoding::Z);
+}
+
+TEST_CASE("test compression tuning") {
+  for (auto &&fname : file_names) {
+    auto raw = read_all_file(fname);
+    auto plain = split_qrs(raw, FileType::B, SplitOption{.min_version = 1, .max_version = 10});
+    auto tuned = split_qrs(raw, FileType::B, SplitOption{.min_version = 1, .max_version = 10, .compression_tuning_ms = 10'000});
+    CHECK(std::pair(tuned.parts.size(), tuned.version) <= std::pair(plain.parts.size(), plain.version));
+    CHECK(join_qrs(tuned.parts).raw == raw);
+  }
+
+  // Z_FILTERED saves about 1% here, which is one part at version 10. Tuning
+  // only applies to zlib, so a builtin default leaves the parts as they are.
+  bool zlib = default_backend_type() == BackendType::Zlib;
+  auto raw = read_all_file("./test_data/real-scan.txt");
+  SplitOption option{.min_version = 10, .max_version = 10};
+  auto plain = split_qrs(raw, FileType::U, option);
+  option.compression_tuning_ms = 10'000;
+  auto tuned = split_qrs(raw, FileType::U, option);
+  CHECK(tuned.parts.size() + zlib == plain.parts.size());
+  CHECK(join_qrs(tuned.parts).raw == raw);
+  option.compression_tuning_ms = 0;
+  CHECK(split_qrs(raw, FileType::U, option).parts == plain.parts);
+}
+
+TEST_CASE("test optimal deflate") {
+  for (auto &&fname : file_names) {
+    auto raw = read_all_file(fname);
+    auto plain = split_qrs(raw, FileType::B, SplitOption{.min_version = 1});
+    auto optimal = split_qrs(raw, FileType::B, SplitOption{.min_version = 1, .optimal_deflate_iterations = 5});
+    CHECK(std::pair(optimal.parts.size(), optimal.version) <= std::pair(plain.parts.size(), plain.version));
+    CHECK(join_qrs(optimal.parts).raw == raw);
+  }
+
+  // long runs, short repeats and distances up to the 1 KB window
+  std::string raw(3'000, '0');
+  for (size_t i = 0; i < 20'000; ++i) {
+    raw += i % 7 ? raw[raw.size() - 1 - i % 1'024] : char('a' + i % 13);
+  }
+  auto optimal = split_qrs(raw, FileType::U, SplitOption{.min_version = 1, .optimal_deflate_iterations = 5});
+  CHECK(optimal.encoding == Encoding::Z);
+  CHECK(join_qrs<std::string>(optimal.parts).raw == raw);
+}
+
+TEST_CASE("test fast deflate") {
+  auto zlib = make_compression_backend(BackendType::Zlib);
+  auto fast = make_compression_backend(BackendType::BuiltinFast);
+  for (auto &&fname : file_names) {
+    auto raw = read_all_file(fname);
+    std::string_view view(reinterpret_cast<const char *>(raw.data()), raw.size());
+    std::string zlib_out, fast_out;
+    REQUIRE(zlib->compress(view, zlib_out));
+    REQUIRE(fast->compress(view, fast_out));
+    CHECK(fast_out.size() <= fast->compress_bound(raw.size()));
+    // within a few percent of zlib's default level
+    CHECK(fast_out.size() <= zlib_out.size() * 103 / 100);
+
+    auto split_result = split_qrs(raw, FileType::B, SplitOption{.min_version = 1, .fast_deflate = true});
+    CHECK(join_qrs(split_result.parts).raw == raw);
+  }
+
+  // long runs, short repeats, distances up to the 1 KB window and more than
+  // one block
+  std::string raw(3'000, '0');
+  for (size_t i = 0; i < 150'000; ++i) {
+    raw += i % 7 ? raw[raw.size() - 1 - i % 1'024] : char('a' + i % 13);
+  }
+  auto split_result = split_qrs(raw, FileType::U, SplitOption{.fast_deflate = true});
+  CHECK(split_result.encoding == Encoding::Z);
+  CHECK(join_qrs<std::string>(split_result.parts).raw == raw);
+  std::string deflated;
+  REQUIRE(fast->compress(raw, deflated));
+  std::vector<unsigned char> inflated;
+  REQUIRE(fast->decompress(std::vector<unsigned char>(deflated.begin(), deflated.end()), inflated));
+  CHECK(std::ranges::equal(inflated, raw));
+}
+
 TEST_CASE("test split and join") {
   for (auto &&fname : file_names) {
     auto raw = read_all_file(fname);
@@ -52,6 +147,13 @@ TEST_CASE("test split and join") {
     }
     auto join_result = join_qrs(split_result.parts);
 
+    // parts are encoded one by one, but must match encoding the whole payload
+    std::string payload;
+    for (auto &&part : split_result.parts) {
+      payload += part.substr(8);
+    }
+    CHECK(payload == encode_data(raw, split_result.encoding, true).first);
+
     CHECK(join_result.is_complete == true);
     CHECK(join_result.expected_part_count == split_result.parts.size());
     CHECK(join_result.processed_parts_count == split_result.parts.size());
@@ -60,6 +162,58 @@ TEST_CASE("test split and join") {
   }
 }
 
+TEST_CASE("test split planning") {
+  std::vector<SplitOption> options = {
+      {},
+      {.min_version = 1, .max_version = 10},
+      {.min_version = 3, .max_version = 25, .min_split = 2},
+      {.min_version = 15, .max_split = 4},
+  };
+  for (auto &&[fname, option] : std::ranges::views::cartesian_product(file_names, options)) {
+    auto raw = read_all_file(fname);
+    std::string_view view(reinterpret_cast<const char *>(raw.data()), raw.size());
+    for (Encoding encoding : {Encoding::H, Encoding::Base32, Encoding::Z}) {
+      option.encoding = encoding;
+      auto split_result = try_split_qrs(raw, FileType::B, option);
+      auto layout = try_plan_for_raw(view, option);
+      REQUIRE(bool(layout) == bool(split_result));
+      if (!split_result) {
+        CHECK(layout.error() == split_result.error());
+        continue;
+      }
+
+      CHECK(layout->encoding == split_result->encoding);
+      if (split_result->encoding == Encoding::Z) {
+        // estimated from samples, within about 1% of the deflated size
+        int count = split_result->parts.size();
+        CHECK(std::abs(layout->count - count) <= 1 + count / 50);
+        CHECK(std::abs(layout->version - split_result->version) <= 1);
+      } else {
+        CHECK(layout->count == split_result->parts.size());
+        CHECK(layout->version == split_result->version);
+        CHECK(layout->per_each == split_result->parts[0].size() - 8);
+      }
+
+      // the exact size of the encoded payload gives the exact layout
+      size_t encoded_size = 0;
+      for (auto &&part : split_result->parts) {
+        encoded_size += part.size() - 8;
+      }
+      auto exact = plan_split(encoded_size, split_result->encoding, option);
+      CHECK(exact.count == split_result->parts.size());
+      CHECK(exact.version == split_result->version);
+    }
+  }
+
+  CHECK(try_plan_split(100, Encoding::H, SplitOption{.min_version = 20, .max_version = 10}).error() == Error::VersionOutOfRange);
+  CHECK(try_plan_split(100, static_cast<Encoding>('?')).error() == Error::InvalidEncoding);
+  CHECK(try_plan_split(size_t(1) << 40, Encoding::H).error() == Error::CannotFit);
+  CHECK(try_plan_split(1295 * (4296 - 8), Encoding::H).value().count == 1295);
+  CHECK(try_plan_split(1295 * (4296 - 8) + 2, Encoding::H).error() == Error::CannotFit);
+  CHECK(plan_split(16, Encoding::Base32, SplitOption{.min_version = 1}).version == 1);
+  CHECK(plan_split(17, Encoding::Base32, SplitOption{.min_version = 1}).version == 2);  // 2 parts at version 1
+}
+
 TEST_CASE("test base36") {
   for (int i = 0; i < 36 * 36; ++i) {
     std::string b36 = int2base36(i);
@@ -69,3 +223,29 @@ TEST_CASE("test base36") {
   CHECK_THROWS(int2base36(-1));
   CHECK_THROWS(int2base36(36 * 36));
 }
+
+TEST_CASE("test base32 encoding") {
+  // RFC 4648 test vectors, without padding
+  CHECK(encode_data(std::string_view("foobar"), Encoding::Base32).first == "MZXW6YTBOI");
+  CHECK(encode_data(std::string_view("fooba"), Encoding::Base32).first == "MZXW6YTB");
+  CHECK(encode_data(std::string_view("f"), Encoding::Base32).first == "MY");
+
+  const auto reference = [](const std::vector<unsigned char> &raw) {
+    static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    std::string str;
+    for (size_t bit = 0; bit < raw.size() * 8; bit += 5) {
+      int v = 0;
+      for (size_t b = bit; b < bit + 5; ++b) {
+        v = (v << 1) | (b / 8 < raw.size() ? (raw[b / 8] >> (7 - b % 8)) & 1 : 0);
+      }
+      str += alphabet[v];
+    }
+    return str;
+  };
+
+  // covers the block loops of every SIMD width and the tails after them
+  for (size_t size = 0; size < 300; ++size) {
+    auto raw = random_bytes(size);
+    CHECK(encode_data(raw, Encoding::Base32).first == reference(raw));
+  }
+}
@@ -0,0 +1,251 @@
+#include <bbqr/bbqr.hpp>
+#include <bbqr/utils.hpp>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "doctest.h"
+#include "stringification.h"
+#include "test_utils.hpp"
+
+using namespace bbqr;
+
+TEST_CASE("test joiner in random order") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<unsigned char> data = random_bytes(20'000);
+
+  for (Encoding encoding : encodings) {
+    auto split_result = split_qrs(data, FileType::B, SplitOption{.encoding = encoding, .force_encoding = true, .max_version = 10});
+    auto parts = split_result.parts;
+    REQUIRE(parts.size() > 1);
+    std::shuffle(parts.begin(), parts.end(), std::mt19937{42});
+
+    Joiner joiner;
+    for (size_t i = 0; i < parts.size(); ++i) {
+      CHECK(joiner.is_complete() == false);
+      CHECK(joiner.add_part(parts[i]) == true);
+      CHECK(joiner.add_part(parts[i]) == false);
+      CHECK(joiner.processed_parts_count() == i + 1);
+      CHECK(joiner.expected_part_count() == parts.size());
+    }
+    CHECK(joiner.is_complete() == true);
+    CHECK(joiner.progress() == doctest::Approx(1.0));
+
+    auto result = joiner.result<std::string>();
+    CHECK(result.file_type == FileType::B);
+    CHECK(result.encoding == encoding);
+    CHECK(result.raw == std::string(data.begin(), data.end()));
+    CHECK(std::move(joiner).result().raw == data);
+  }
+}
+
+TEST_CASE("test joiner rejects bad parts") {
+  auto split_result = split_qrs(random_bytes(5'000), FileType::B, SplitOption{.max_version = 10});
+  auto parts = split_result.parts;
+  REQUIRE(parts.size() > 2);
+
+  Joiner joiner;
+  CHECK_THROWS_AS(joiner.add_part("B$ZB01"), std::invalid_argument);
+  CHECK_THROWS_AS(joiner.add_part("X$ZB0100AAAA"), std::invalid_argument);
+  CHECK(joiner.try_add_part("B$ZQ" + parts[0].substr(4)).error() == Error::InvalidFileType);
+  CHECK(joiner.progress() == 0);
+
+  joiner.add_part(parts[0]);
+  std::string other_type = parts[1];
+  other_type[3] = 'P';
+  CHECK_THROWS_AS(joiner.add_part(other_type), std::invalid_argument);
+
+  std::string out_of_range = parts[1];
+  out_of_range.replace(6, 2, "ZZ");
+  CHECK_THROWS_AS(joiner.add_part(out_of_range), std::invalid_argument);
+
+  std::string tampered = parts[0];
+  tampered.back() = tampered.back() == 'A' ? 'B' : 'A';
+  CHECK_THROWS_AS(joiner.add_part(tampered), std::invalid_argument);
+  CHECK(joiner.processed_parts_count() == 1);
+}
+
+TEST_CASE("test joiner recovers from rejected parts") {
+  std::vector<unsigned char> data = read_all_file("./test_data/1in1000out.psbt");
+  for (Encoding encoding : {Encoding::H, Encoding::Base32, Encoding::Z}) {
+    auto parts = split_qrs(data, FileType::P, SplitOption{.encoding = encoding, .max_version = 10}).parts;
+    REQUIRE(parts.size() > 2);
+
+    // a garbled first frame must not lock the joiner to its header
+    Joiner joiner;
+    auto garbled = joiner.try_add_part("B$2B0200!!!!!!!!");
+    REQUIRE(!garbled);
+    CHECK(garbled.error() == Error::InvalidBase32);
+    CHECK(joiner.expected_part_count() == 0);
+    CHECK(joiner.encoding() == Encoding{});
+
+    // a bad part is taken back, also from the inflater
+    joiner.add_part(parts[2]);
+    std::string bad = parts[0];
+    if (encoding == Encoding::Z) {
+      bad.replace(8, 2, "A7");  // a final block of the reserved type 3
+    } else {
+      bad[8] = '!';
+    }
+    auto rejected = joiner.try_add_part(bad);
+    REQUIRE(!rejected);
+    CHECK(rejected.error() == (encoding == Encoding::Z ? Error::DecompressionFailed
+                               : encoding == Encoding::H ? Error::InvalidHex : Error::InvalidBase32));
+    CHECK(joiner.processed_parts_count() == 1);
+    CHECK(joiner.prefix().empty());
+
+    for (auto &&part : parts) {
+      joiner.add_part(part);
+    }
+    CHECK(joiner.is_complete());
+    CHECK(joiner.result().raw == data);
+  }
+}
+
+TEST_CASE("test joiner last part first") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<unsigned char> data = random_bytes(3'000);
+
+  for (Encoding encoding : encodings) {
+    auto parts = split_qrs(data, FileType::B, SplitOption{.encoding = encoding, .force_encoding = true, .max_version = 10}).parts;
+    REQUIRE(parts.size() > 2);
+
+    Joiner joiner;
+    joiner.add_part(parts.back());
+    CHECK(joiner.add_part(parts.back()) == false);
+    for (size_t i = 0; i + 1 < parts.size(); ++i) {
+      joiner.add_part(parts[i]);
+    }
+    CHECK(joiner.add_part(parts.back()) == false);
+    CHECK(joiner.result().raw == data);
+
+    Joiner short_part;
+    short_part.add_part(parts[0]);
+    CHECK_THROWS_AS(short_part.add_part(parts[1].substr(0, parts[1].size() - 8)), std::invalid_argument);
+  }
+}
+
+TEST_CASE("test joiner decoded prefix") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<unsigned char> data = read_all_file("./test_data/1in1000out.psbt");
+
+  for (Encoding encoding : encodings) {
+    auto parts = split_qrs(data, FileType::P, SplitOption{.encoding = encoding, .max_version = 10}).parts;
+    REQUIRE(parts.size() > 2);
+    CHECK(Joiner().prefix().empty());
+
+    Joiner joiner;
+    joiner.add_part(parts[1]);
+    CHECK(joiner.prefix().empty());
+
+    size_t prefix_size = 0;
+    joiner.add_part(parts[0]);
+    for (size_t i = 2; i < parts.size(); ++i) {
+      auto prefix = joiner.prefix();
+      CHECK(prefix.size() >= prefix_size);
+      CHECK(prefix.size() < data.size());
+      CHECK(std::equal(prefix.begin(), prefix.end(), data.begin()));
+      prefix_size = prefix.size();
+      joiner.add_part(parts[i]);
+    }
+    CHECK(prefix_size > 0);
+    CHECK(joiner.is_complete() == true);
+    CHECK(std::ranges::equal(joiner.prefix(), data));
+    CHECK(joiner.result().raw == data);
+  }
+}
+
+TEST_CASE("test joiner truncated Z stream") {
+  auto parts = split_qrs(read_all_file("./test_data/1in1000out.psbt"), FileType::P, SplitOption{.max_version = 10}).parts;
+  REQUIRE(parts.size() > 2);
+
+  // claim one part fewer than was sent, dropping the end of the deflate stream
+  std::string count = int2base36(parts.size() - 1);
+  Joiner joiner;
+  for (size_t i = 0; i + 2 < parts.size(); ++i) {
+    joiner.add_part(parts[i].replace(4, 2, count));
+  }
+  std::vector<unsigned char> prefix(joiner.prefix().begin(), joiner.prefix().end());
+  std::string last = parts[parts.size() - 2].replace(4, 2, count);
+  CHECK_THROWS_AS(joiner.add_part(last), std::runtime_error);
+
+  // the joiner is back where it was before the last part
+  CHECK(!joiner.is_complete());
+  CHECK(joiner.processed_parts_count() == parts.size() - 2);
+  CHECK(std::ranges::equal(joiner.prefix(), prefix));
+  CHECK_THROWS_AS(joiner.add_part(last), std::runtime_error);
+}
+
+TEST_CASE("test multi joiner with interleaved sequences") {
+  std::vector<unsigned char> psbt = read_all_file("./test_data/1in100out.psbt");
+  std::string json = R"json({"descriptor": "wsh(sortedmulti(2,[0f056943/48h/1h/0h/2h]tpubDF2rnouQaaYrXF4noGTv6rQYmx87cQ4GrUdhpvXkhtChwQPbdGTi8GA88NUaSrwZBwNsTkC9bFkkC8vDyGBVVAQTZ2AS6gs68RQXtXcCvkP/0/*))"})json";
+  std::vector<unsigned char> text = random_bytes(2'000);
+
+  auto psbt_parts = split_qrs(psbt, FileType::P, SplitOption{.max_version = 5}).parts;
+  auto json_parts = split_qrs(json, FileType::J, SplitOption{.min_version = 1, .max_version = 2}).parts;
+  auto text_parts = split_qrs(text, FileType::U, SplitOption{.encoding = Encoding::H, .max_version = 5}).parts;
+  REQUIRE(psbt_parts.size() > 1);
+  REQUIRE(json_parts.size() > 1);
+
+  std::vector<std::string> completed;
+  MultiJoiner joiner(8, [&](const Joiner &j) { completed.push_back(j.result<std::string>().raw); });
+
+  // the camera sees each animation loop twice, frames interleaved with noise
+  for (int loop = 0; loop < 2; ++loop) {
+    size_t frames = std::max({psbt_parts.size(), json_parts.size(), text_parts.size()});
+    for (size_t i = 0; i < frames; ++i) {
+      CHECK(joiner.try_add_part("not a bbqr frame").error() == Error::InvalidHeader);
+      for (auto *parts : {&psbt_parts, &json_parts, &text_parts}) {
+        if (i < parts->size()) {
+          CHECK(joiner.add_part((*parts)[i]) == (loop == 0));
+        }
+      }
+    }
+  }
+
+  REQUIRE(completed.size() == 3);
+  CHECK(joiner.session_count() == 3);
+  CHECK(std::count(completed.begin(), completed.end(), json) == 1);
+  CHECK(std::count(completed.begin(), completed.end(), std::string(psbt.begin(), psbt.end())) == 1);
+  CHECK(std::count(completed.begin(), completed.end(), std::string(text.begin(), text.end())) == 1);
+
+  const Joiner *psbt_joiner = joiner.find(std::string_view(psbt_parts[0]).substr(0, 6));
+  REQUIRE(psbt_joiner != nullptr);
+  CHECK(psbt_joiner->file_type() == FileType::P);
+  joiner.erase(std::string_view(psbt_parts[0]).substr(0, 6));
+  CHECK(joiner.find(std::string_view(psbt_parts[0]).substr(0, 6)) == nullptr);
+}
+
+TEST_CASE("test multi joiner callback throws") {
+  auto parts = split_qrs(random_bytes(500), FileType::B, SplitOption{.encoding = Encoding::H, .min_version = 1, .min_split = 2, .max_split = 2}).parts;
+  REQUIRE(parts.size() == 2);
+
+  MultiJoiner joiner(8, [](const Joiner &j) { throw std::runtime_error(std::to_string(j.processed_parts_count())); });
+  CHECK(joiner.try_add_part(parts[0]).value() == true);
+  CHECK_THROWS_AS(static_cast<void>(joiner.try_add_part(parts[1])), std::runtime_error);
+
+  // the part that completed the transfer is in, and completes it only once
+  const Joiner *session = joiner.find(std::string_view(parts[0]).substr(0, 6));
+  REQUIRE(session != nullptr);
+  CHECK(session->is_complete());
+  CHECK(joiner.try_add_part(parts[1]).value() == false);
+}
+
+TEST_CASE("test multi joiner evicts least recently used") {
+  std::vector<std::vector<std::string>> transfers;
+  for (int count = 2; count < 6; ++count) {
+    transfers.push_back(split_qrs(random_bytes(100 * count), FileType::B, SplitOption{.encoding = Encoding::H, .min_version = 1, .min_split = count, .max_split = count}).parts);
+    REQUIRE(transfers.back().size() == count);
+  }
+
+  MultiJoiner joiner(2);
+  joiner.add_part(transfers[0][0]);
+  joiner.add_part(transfers[1][0]);
+  joiner.add_part(transfers[0][1]);  // transfer 0 is now the most recently used
+  joiner.add_part(transfers[2][0]);  // evicts transfer 1
+  CHECK(joiner.session_count() == 2);
+  CHECK(joiner.find(std::string_view(transfers[0][0]).substr(0, 6)) != nullptr);
+  CHECK(joiner.find(std::string_view(transfers[1][0]).substr(0, 6)) == nullptr);
+  CHECK(joiner.find(std::string_view(transfers[2][0]).substr(0, 6)) != nullptr);
+  CHECK(joiner.find(std::string_view(transfers[0][0]).substr(0, 6))->is_complete() == true);
+}
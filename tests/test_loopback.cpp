@@ -1,9 +1,14 @@
+#include <bbqr/backend.hpp>
+#include <bbqr/batch.hpp>
 #include <bbqr/bbqr.hpp>
 #include <bbqr/utils.hpp>
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
 #include <format>
 #include <numeric>
 #include <ranges>
+#include <thread>
 
 #include "doctest.h"
 #include "stringification.h"
@@ -130,3 +135,301 @@ TEST_CASE("Test max size") {
     CHECK(join_result.raw == data);
   }
 }
+
+TEST_CASE("test parallel join") {
+  int nparts = 36 * 36 - 1;
+  Codec codec;
+  for (Encoding encoding : {Encoding::H, Encoding::Base32}) {
+    int pkt_size = encoding == Encoding::H ? (4296 - 8) / 2 : (4296 - 8) * 5 / 8;
+    std::vector<unsigned char> data = random_bytes(nparts * pkt_size - 7);
+    auto split_result = split_qrs(data, FileType::B, SplitOption{.encoding = encoding, .min_version = 40});
+    REQUIRE(split_result.parts.size() == nparts);
+
+    for (unsigned threads : {0u, 2u, 7u}) {
+      CHECK(join_qrs(split_result.parts, nullptr, threads).raw == data);
+      CHECK(codec.join_qrs(split_result.parts, nullptr, threads).raw == data);
+
+      std::vector<std::byte> out(decoded_size_upper_bound(split_result.parts).value());
+      auto into = join_into(split_result.parts, out, threads);
+      CHECK(std::ranges::equal(into.raw, std::as_bytes(std::span(data))));
+      CHECK(try_join_into(split_result.parts, std::span(out).first(out.size() - 1), threads).error() == Error::BufferTooSmall);
+    }
+
+    // the first bad part is reported, as without threads
+    auto parts = split_result.parts;
+    parts[900][100] = '!';
+    parts[300][100] = '@';
+    Error error = encoding == Encoding::H ? Error::InvalidHex : Error::InvalidBase32;
+    CHECK(try_join_qrs(parts, nullptr, 0).error() == error);
+
+    // a duplicate sent in lowercase is the same part, as without threads
+    parts = split_result.parts;
+    std::string lower = parts[500];
+    std::transform(lower.begin() + 8, lower.end(), lower.begin() + 8, [](unsigned char c) { return std::tolower(c); });
+    REQUIRE(lower != parts[500]);
+    parts.push_back(lower);
+    CHECK(join_qrs(parts).raw == data);
+    CHECK(join_qrs(parts, nullptr, 4).raw == data);
+    CHECK(codec.join_qrs(parts, nullptr, 4).raw == data);
+    lower[100] = lower[100] == 'a' ? 'b' : 'a';
+    parts.back() = lower;
+    CHECK(try_join_qrs(parts).error() == Error::DuplicateMismatch);
+    CHECK(try_join_qrs(parts, nullptr, 4).error() == Error::DuplicateMismatch);
+
+    // an incomplete set decodes nothing
+    parts = split_result.parts;
+    parts.pop_back();
+    CHECK(!join_qrs(parts, nullptr, 0).is_complete);
+  }
+
+  // too little to share out, and Z, still join
+  auto small = split_qrs(std::string(100, 'A'), FileType::U, SplitOption{.encoding = Encoding::Base32, .min_version = 1, .min_split = 3});
+  CHECK(join_qrs<std::string>(small.parts, nullptr, 0).raw == std::string(100, 'A'));
+  auto z = split_qrs(std::string(5000, 'A'), FileType::U, SplitOption{.min_version = 1, .min_split = 2});
+  REQUIRE(z.encoding == Encoding::Z);
+  CHECK(join_qrs<std::string>(z.parts, nullptr, 0).raw == std::string(5000, 'A'));
+}
+
+TEST_CASE("test parallel split") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<int> sizes = {100, 1295 * 2144 - 3};
+
+  for (const auto &[encoding, size] : std::ranges::views::cartesian_product(encodings, sizes)) {
+    std::vector<unsigned char> data = random_bytes(size);
+    SplitOption option{.encoding = encoding, .force_encoding = true, .min_version = 1};
+    auto split_result = split_qrs(data, FileType::B, option);
+
+    for (unsigned threads : {0u, 3u}) {
+      option.threads = threads;
+      CHECK(split_qrs(data, FileType::B, option).parts == split_result.parts);
+      CHECK(std::ranges::equal(split_qrs_arena(data, FileType::B, option).parts, split_result.parts));
+    }
+  }
+}
+
+// Runs the jobs in reverse on the calling thread, to check the interface
+class ReverseExecutor final : public BatchExecutor {
+ public:
+  void run(size_t count, const std::function<void(size_t)> &job) override {
+    for (size_t i = count; i-- > 0;) {
+      job(i);
+    }
+  }
+};
+
+TEST_CASE("test batch split and join") {
+  std::vector<std::vector<unsigned char>> data;
+  std::vector<Payload> payloads;
+  for (int size : {300, 500'000, 2000, 300, 80'000, 1, 300'000, 7000}) {
+    data.push_back(data.size() % 2 ? std::vector<unsigned char>(size, 'A') : random_bytes(size));
+  }
+  for (auto &&raw : data) {
+    payloads.push_back({std::string_view(reinterpret_cast<const char *>(raw.data()), raw.size()), FileType::B});
+  }
+  std::vector<unsigned char> too_large = random_bytes(2'000'000);
+  payloads.push_back({std::string_view(reinterpret_cast<const char *>(too_large.data()), too_large.size()), FileType::B});
+
+  ThreadPool pool(3);
+  CHECK(pool.size() == 3);
+  ReverseExecutor reverse;
+  std::vector<BatchExecutor *> executors = {nullptr, &pool, &reverse};
+  SplitOption option{.min_version = 1, .max_version = 20};
+  for (BatchExecutor *executor : executors) {
+    auto splits = split_batch(payloads, option, executor);
+    REQUIRE(splits.size() == payloads.size());
+    REQUIRE(!splits.back());
+    CHECK(splits.back().error() == Error::CannotFit);
+
+    std::vector<std::vector<std::string>> batches;
+    for (size_t i = 0; i < data.size(); ++i) {
+      auto single = split_qrs(data[i], FileType::B, option);
+      REQUIRE(splits[i]);
+      CHECK(splits[i]->parts == single.parts);
+      batches.push_back(splits[i]->parts);
+    }
+    batches.push_back({"B$ZU0100bad"});
+
+    auto joins = join_batch(batches, executor);
+    REQUIRE(joins.size() == batches.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+      REQUIRE(joins[i]);
+      CHECK(joins[i]->raw == data[i]);
+    }
+    CHECK(!joins.back());
+  }
+
+  // the pool runs batch after batch, also from several threads at once
+  std::vector<std::jthread> callers;
+  for (int t = 0; t < 3; ++t) {
+    callers.emplace_back([&] {
+      for (int round = 0; round < 20; ++round) {
+        auto joins = join_batch<std::string>(std::vector<std::vector<std::string>>(10, {"B$HT0100616263"}), &pool);
+        CHECK(std::ranges::all_of(joins, [](auto &&join) { return join && join->raw == "abc"; }));
+      }
+    });
+  }
+  callers.clear();
+  CHECK(split_batch({}, option, &pool).empty());
+}
+
+TEST_CASE("test arena split") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<int> sizes = {1, 100, 10'000, 1295 * 2144};
+
+  for (const auto &[encoding, size] : std::ranges::views::cartesian_product(encodings, sizes)) {
+    std::vector<unsigned char> data = random_bytes(size);
+    SplitOption option{.encoding = encoding, .min_version = 1};
+
+    auto split_result = split_qrs(data, FileType::B, option);
+    auto arena_result = split_qrs_arena(data, FileType::B, option);
+    // moving the result keeps the parts valid
+    ArenaSplitResult moved = std::move(arena_result);
+
+    CHECK(moved.version == split_result.version);
+    CHECK(moved.encoding == split_result.encoding);
+    CHECK(std::ranges::equal(moved.parts, split_result.parts));
+
+    Joiner joiner;
+    for (std::string_view part : moved.parts) {
+      joiner.add_part(part);
+    }
+    CHECK(joiner.result().raw == data);
+  }
+}
+
+TEST_CASE("test lazy split") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<int> sizes = {1, 3, 100, 10'000, 50'000};
+  std::vector<bool> low_ents = {true, false};
+
+  for (const auto &[encoding, size, low_ent] : std::ranges::views::cartesian_product(encodings, sizes, low_ents)) {
+    std::vector<unsigned char> data = low_ent ? std::vector<unsigned char>(size, 'A') : random_bytes(size);
+    std::string_view raw(reinterpret_cast<const char *>(data.data()), data.size());
+    SplitOption option{.encoding = encoding, .min_version = 1, .max_version = 20};
+
+    auto split_result = split_qrs(data, FileType::B, option);
+    LazySplit lazy = split_lazy(raw, FileType::B, option);
+    static_assert(std::input_iterator<LazySplit::iterator>);
+
+    CHECK(lazy.version() == split_result.version);
+    CHECK(lazy.encoding() == split_result.encoding);
+    REQUIRE(lazy.size() == split_result.parts.size());
+    CHECK(std::ranges::equal(lazy, split_result.parts));
+    CHECK(lazy.part(lazy.size() - 1) == split_result.parts.back());
+  }
+}
+
+TEST_CASE("test codec") {
+  std::vector<Encoding> encodings = {Encoding::H, Encoding::Base32, Encoding::Z};
+  std::vector<int> sizes = {1, 3, 100, 10'000, 50'000, 200};
+  std::vector<bool> low_ents = {true, false};
+
+  // one codec for every payload, so its streams and buffers get reused
+  Codec codec;
+  for (const auto &[encoding, size, low_ent] : std::ranges::views::cartesian_product(encodings, sizes, low_ents)) {
+    std::vector<unsigned char> data = low_ent ? std::vector<unsigned char>(size, 'A') : random_bytes(size);
+    std::string_view raw(reinterpret_cast<const char *>(data.data()), data.size());
+    SplitOption option{.encoding = encoding, .min_version = 1, .max_version = 20};
+
+    auto split_result = codec.split_qrs(raw, FileType::B, option);
+    auto expected = split_qrs(data, FileType::B, option);
+    CHECK(split_result.version == expected.version);
+    CHECK(split_result.encoding == expected.encoding);
+    CHECK(split_result.parts == expected.parts);
+
+    auto join_result = codec.join_qrs(split_result.parts);
+    CHECK(join_result.is_complete);
+    CHECK(join_result.encoding == split_result.encoding);
+    CHECK(join_result.raw == data);
+  }
+
+  auto split_result = codec.split_qrs(std::string(5000, 'A'), FileType::U, SplitOption{.min_version = 1, .min_split = 2});
+  REQUIRE(split_result.encoding == Encoding::Z);
+  split_result.parts.back().back() ^= 1;
+  CHECK(!codec.try_join_qrs(split_result.parts));
+  split_result.parts.pop_back();
+  CHECK(!codec.join_qrs<std::string>(split_result.parts).is_complete);
+}
+
+TEST_CASE("test codec repeated joins") {
+  // large and small payloads in turn, and failed joins in between, through
+  // the one decompressor and output buffer of a codec
+  std::vector<std::vector<std::string>> sets;
+  std::vector<std::string> raws;
+  for (size_t size : {50'000, 10, 3'000, 120'000, 1}) {
+    std::string raw(size, 'A');
+    for (size_t i = 0; i < size; i += 7) {
+      raw[i] = char('a' + i % 23);
+    }
+    auto split_result = split_qrs(raw, FileType::U, SplitOption{.encoding = Encoding::Z, .force_encoding = true, .min_version = 1, .max_version = 20});
+    REQUIRE(split_result.encoding == Encoding::Z);
+    sets.push_back(split_result.parts);
+    raws.push_back(raw);
+  }
+  auto corrupt = sets[0];
+  corrupt.back().back() ^= 1;
+
+  Codec codec;
+  for (int round = 0; round < 20; ++round) {
+    size_t i = round % sets.size();
+    CHECK(codec.join_qrs<std::string>(sets[i], nullptr, round % 2 + 1).raw == raws[i]);
+    auto bytes = codec.join_qrs(sets[i]).raw;
+    CHECK(std::string(bytes.begin(), bytes.end()) == raws[i]);
+    CHECK(!codec.try_join_qrs(corrupt));
+  }
+}
+
+TEST_CASE("test compression backends") {
+  auto zlib = make_compression_backend(BackendType::Zlib);
+  auto builtin = make_compression_backend(BackendType::Builtin);
+  auto fast = make_compression_backend(BackendType::BuiltinFast);
+  CHECK(std::string_view(zlib->name()) == "zlib");
+  CHECK(std::string_view(builtin->name()) == "builtin");
+  CHECK(std::string_view(fast->name()) == "builtin-fast");
+  std::vector<CompressionBackend *> backends = {nullptr, zlib.get(), builtin.get(), fast.get()};
+  std::vector<int> sizes = {1, 100, 2000, 50'000};
+  std::vector<bool> low_ents = {true, false};
+
+  Codec codec;
+  for (const auto &[size, low_ent] : std::ranges::views::cartesian_product(sizes, low_ents)) {
+    std::vector<unsigned char> data = low_ent ? std::vector<unsigned char>(size, 'A') : random_bytes(size);
+    std::string_view raw(reinterpret_cast<const char *>(data.data()), data.size());
+    for (CompressionBackend *backend : std::ranges::subrange(backends.begin() + 1, backends.end())) {
+      std::string compressed;
+      REQUIRE(backend->compress(raw, compressed));
+      CHECK(compressed.size() <= backend->compress_bound(data.size()));
+    }
+
+    // every backend inflates what any other one deflated
+    for (const auto &[split_backend, join_backend] : std::ranges::views::cartesian_product(backends, backends)) {
+      SplitOption option{.encoding = Encoding::Z, .min_version = 1, .max_version = 20, .compression_backend = split_backend};
+      auto split_result = split_qrs(data, FileType::B, option);
+      if (low_ent && size >= 100) {
+        CHECK(split_result.encoding == Encoding::Z);
+      }
+
+      auto join_result = join_qrs(split_result.parts, join_backend);
+      CHECK(join_result.is_complete);
+      CHECK(join_result.raw == data);
+      CHECK(codec.join_qrs(split_result.parts, join_backend).raw == data);
+    }
+  }
+
+  auto split_result = split_qrs(std::string(5000, 'A'), FileType::U, SplitOption{.min_version = 1, .min_split = 2});
+  REQUIRE(split_result.encoding == Encoding::Z);
+  split_result.parts.back().back() ^= 1;
+  for (CompressionBackend *backend : backends) {
+    CHECK(!try_join_qrs(split_result.parts, backend));
+    CHECK(!codec.try_join_qrs(split_result.parts, backend));
+  }
+
+  // a stream cut short only fails in the inflater
+  std::string compressed;
+  REQUIRE(zlib->compress(std::string(5000, 'A'), compressed));
+  std::vector<unsigned char> truncated(compressed.begin(), compressed.end() - 1), out;
+  for (CompressionBackend *backend : std::ranges::subrange(backends.begin() + 1, backends.end())) {
+    auto result = backend->decompress(truncated, out);
+    REQUIRE(!result);
+    CHECK(result.error() == Error::DecompressionFailed);
+  }
+}